@@ -28,9 +28,10 @@ using std::pair;
 
 using std::ofstream;
 
-BrowseMode::BrowseMode()
+BrowseMode::BrowseMode(unsigned int prefetch_depth)
 : auto_advance(true),
-  blender(&Library::motion(0), &Library::motion(1))
+  blender(&Library::pin(0), &Library::pin(1)),
+  prefetch(prefetch_depth)
 {
   camera = make_vector(10.0f, 10.0f, 10.0f);
   target = make_vector(0.0f, 0.0f, 0.0f);
@@ -39,13 +40,25 @@ BrowseMode::BrowseMode()
   current_pose.clear();
   current_state.clear();
   current_motion = 0;
+  next_motion = 1;
   time = 0.0f;
   play_speed = 1.0f;
   frame = 0;
+  use_graph = true;
+  graph_checked = false;
+
+  prepare_next_blend();
+
+  /* Pinned before the blender read them; prepare_next_blend has pinned
+   * them again for as long as they play */
+  Library::unpin(*blender.getFromMotion());
+  Library::unpin(*blender.getToMotion());
 }
 
 BrowseMode::~BrowseMode()
 {
+  /* next_blend keeps its own pins on whatever it's still building */
+  for(unsigned int i = 0; i < pinned.size(); ++i) Library::unpin(*pinned[i]);
 }
 
 void BrowseMode::update(float const elapsed_time)
@@ -69,11 +82,13 @@ void BrowseMode::update(float const elapsed_time)
 
   if(auto_advance && blender.firstAnimationIsDone())
   {
-    // Increment the current motion, looping around to zero if we've reached
-    // the end.
-    if(++current_motion >= Library::motion_count()) current_motion = 0;
+    // Move on to the motion prepare_next_blend picked (the next one, looping
+    // around to zero at the end, unless the motion graph chose another)
+    current_motion = next_motion;
 
-    blender = Library::LerpBlender::blendFromBlend(blender, &Library::motion(current_motion));
+    // Usually the blend has already been built in the background
+    next_blend.advance(blender, &Library::motion(current_motion));
+    prepare_next_blend();
   }
 
   blender.getPose(current_pose);
@@ -113,10 +128,99 @@ void BrowseMode::switch_motion(short delta)
   time = 0.0f;
   frame = 0;
 
-  const Library::Motion *m1 = &Library::motion(current_motion);
-  const Library::Motion *m2 = &Library::motion((current_motion + 1) % Library::motion_count());
+  /* Pinned before the blender reads them, as in the constructor */
+  const Library::Motion *m1 = &Library::pin(current_motion);
+  const Library::Motion *m2 = &Library::pin((current_motion + 1) % Library::motion_count());
+
+  Library::LerpBlender next(m1, m2);
+  blender.swap(next);
+
+  prepare_next_blend();
+  Library::unpin(*m1);
+  Library::unpin(*m2);
+}
+
+void BrowseMode::prepare_next_blend()
+{
+  next_motion = pick_next_motion();
+  const Library::Motion *after = pin_blend_motions(next_motion);
+  next_blend.start(blender.getToMotion(), after, blender.getPathMethod());
+
+  /* A jump with PageUp/PageDown lands here too, and drops whatever was
+   * being fetched for where we were before */
+  prefetch.start(upcoming_motions());
+}
 
-  blender = Library::LerpBlender(m1, m2);
+unsigned int BrowseMode::pick_next_motion()
+{
+  /* The graph only matches the library once every motion is in it */
+  if(!graph_checked && Library::loading_done())
+  {
+    graph_checked = true;
+    if(graph.load(Library::cache_file("motion.graph")))
+    {
+      cout << "Picking the motions to blend into from the motion graph (G toggles)." << endl;
+    }
+  }
+
+  unsigned int from, to;
+  if(!Library::find_motion(blender.getFromMotion()->filename, from) ||
+     !Library::find_motion(blender.getToMotion()->filename, to))
+  {
+    return (current_motion + 1) % Library::motion_count();
+  }
+  return motion_after(from, to, current_motion);
+}
+
+unsigned int BrowseMode::motion_after(unsigned int from, unsigned int to,
+                                      unsigned int current) const
+{
+  unsigned int in_order = (current + 1) % Library::motion_count();
+  if(!use_graph || graph.motions() == 0) return in_order;
+
+  /* The cheapest transition out of the motion being blended into, to
+   * anything but itself or the one just left (else it'd bounce between
+   * two) */
+  for(unsigned int e = 0; e < graph.edge_count(to); ++e)
+  {
+    unsigned int m = graph.edge(to, e).to_motion;
+    if(m != to && m != from) return m;
+  }
+  return in_order;
+}
+
+vector<unsigned int> BrowseMode::upcoming_motions() const
+{
+  vector<unsigned int> upcoming(1, next_motion);
+
+  /* Once the next blend is under way it goes from the current to motion
+   * into next_motion, and next_motion is the one playing; each blend after
+   * that carries on from the one before */
+  unsigned int from = next_motion;
+  Library::find_motion(blender.getToMotion()->filename, from);
+  unsigned int to = next_motion;
+  while(upcoming.size() < prefetch.getDepth())
+  {
+    unsigned int after = motion_after(from, to, to);
+    upcoming.push_back(after);
+    from = to;
+    to = after;
+  }
+  return upcoming;
+}
+
+const Library::Motion *BrowseMode::pin_blend_motions(unsigned int after)
+{
+  vector<const Library::Motion *> now;
+  now.push_back(blender.getFromMotion());
+  now.push_back(blender.getToMotion());
+
+  /* Pin the new ones first, so motions in both lists stay loaded */
+  for(unsigned int i = 0; i < now.size(); ++i) Library::pin(*now[i]);
+  now.push_back(&Library::pin(after));
+  for(unsigned int i = 0; i < pinned.size(); ++i) Library::unpin(*pinned[i]);
+  pinned.swap(now);
+  return pinned.back();
 }
 
 void BrowseMode::handle_event(SDL_Event const &event)
@@ -131,6 +235,11 @@ void BrowseMode::handle_event(SDL_Event const &event)
   {
     auto_advance = !auto_advance;
   }
+  if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_g)
+  {
+    use_graph = !use_graph;
+    prepare_next_blend();
+  }
   if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)
   {
     quit_flag = true;
@@ -167,7 +276,7 @@ void BrowseMode::handle_event(SDL_Event const &event)
   {
     for (unsigned int m = 0; m < Library::motion_count(); ++m)
     {
-      Library::Motion const &motion = Library::motion(m);
+      Library::Motion const &motion = Library::pin(m);
       cout << "Dumpping '" << motion.filename + ".global" << "'" << endl;
       ofstream out((motion.filename + ".global").c_str());
       out << "\"position.x\", \"position.z\", \"position.yaw\", \"root.x\", \"root.y\", \"root.z\"";
@@ -181,11 +290,14 @@ void BrowseMode::handle_event(SDL_Event const &event)
         out << '"' << motion.skeleton->bones[b].name << ".z" << '"';
       }
       out << endl;
+      Library::PoseBlock poses;
+      motion.get_poses(0, motion.frames(), poses);
+      Character::Pose p;
       for (unsigned int f = 0; f < motion.frames(); ++f)
       {
         Character::WorldBones w;
-        Character::Pose p;
-        motion.get_local_pose(f, p);
+        poses.get_pose(f, p);
+        motion.get_local_root(f, p);
         Character::get_world_bones(p, w);
         {
           Character::StateDelta delta;
@@ -207,6 +319,7 @@ void BrowseMode::handle_event(SDL_Event const &event)
         }
         out << endl;
       }
+      Library::unpin(motion);
     }
   }
 
@@ -6,6 +6,9 @@
 #include <Character/Character.hpp>
 #include <Character/Skin.hpp>
 #include <Library/LerpBlender.hpp>
+#include <Library/BackgroundBlender.hpp>
+#include <Library/Prefetcher.hpp>
+#include <Library/MotionGraph.hpp>
 
 #include <vector>
 #include <deque>
@@ -20,7 +23,9 @@ using std::string;
 class BrowseMode : public Mode
 {
 public:
-  BrowseMode();
+  /* Keeps the next prefetch_depth motions it will play loading in the
+   * background (which only matters when the library loads lazily). */
+  BrowseMode(unsigned int prefetch_depth = 2);
   virtual ~BrowseMode();
 
   virtual void update(float const elapsed_time);
@@ -45,14 +50,55 @@ public:
   Character::State current_state;
   Vector3f current_motion_root;
   unsigned int current_motion;
+  unsigned int next_motion;
   unsigned int frame;
   float time;
   float play_speed;
 
   Character::Skin skin;
 
+  /* If true (and Tools/motiongraph has saved a graph for this library),
+   * auto_advance blends into whichever motion the graph says is cheapest
+   * to get to, instead of the next one.  The graph's signature only
+   * matches a library that isn't loaded lazily. */
+  bool use_graph;
+
 private:
+  /* Starts building the blend auto_advance will want next, from the
+   * current to motion into the one after it. */
+  void prepare_next_blend();
+
+  /* The motion the next blend should go into */
+  unsigned int pick_next_motion();
+
+  /* The motion to blend into after a blend from motion 'from' into motion
+   * 'to', with motion 'current' playing: the graph's choice if it's in
+   * use, else the one after 'current' */
+  unsigned int motion_after(unsigned int from, unsigned int to,
+                            unsigned int current) const;
+
+  /* next_motion, then the motions auto_advance will play after it (as
+   * motion_after picks them), as far ahead as the prefetcher looks */
+  vector<unsigned int> upcoming_motions() const;
+
+  /* Pins the motions the blends use (the current blend's two and motion
+   * 'after', which the next blend goes into), unpinning the ones they used
+   * before, so the library can't unload them while they play.  Returns
+   * motion 'after'. */
+  const Library::Motion *pin_blend_motions(unsigned int after);
+  vector<const Library::Motion *> pinned;
+
   Library::LerpBlender blender;
+
+  // Builds the next blend while the current one plays
+  Library::BackgroundBlender next_blend;
+
+  // Loads the motions that play after those while they play
+  Library::Prefetcher prefetch;
+
+  // Transitions worked out ahead of time, if there's a graph to load
+  Library::MotionGraph graph;
+  bool graph_checked;           // tried loading it (once the library had)
 };
 
 #endif //BROWSEMODE_HPP
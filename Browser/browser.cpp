@@ -10,6 +10,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <stdlib.h>
 
 using std::cout;
 using std::cerr;
@@ -20,19 +21,26 @@ int main(int argc, char **argv)
 {
 
   string path = "data";
-  if (argc == 2)
+  bool lazy = false;
+  if (argc >= 2)
   {
     path = argv[1];
   }
-  Library::init(path);
-
-  if (Library::motion_count() == 0)
+  if (argc >= 3)
   {
-    cerr << "------------ERROR-------------" << endl;
-    cerr << "Could not find any motions to browse in directory '" << path << "'.\nPlease either place amc files and associated asf here, or specify a different\n directory on on the command line." << endl;
-    return 1;
+    //memory budget in megabytes: load motions as they're browsed, keeping
+    //at most about this much around.
+    Library::memory_budget = (size_t)atoi(argv[2]) * 1024 * 1024;
+    lazy = true;
   }
-
+  unsigned int prefetch_depth = 2;
+  if (argc >= 4)
+  {
+    //how many motions ahead to load in the background:
+    prefetch_depth = atoi(argv[3]);
+  }
+  //SDL (and so its threads and mutexes) before the library, which uses them
+  //to load:
   if (SDL_Init(SDL_INIT_TIMER) != 0)
   {
     cerr << "------------ERROR-------------" << endl;
@@ -40,16 +48,41 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  if (lazy)
+  {
+    Library::init(path, lazy);
+  }
+  else
+  {
+    //the window can come up and playback start while the rest load:
+    Library::init_progressive(path);
+  }
+
   if (!Graphics::init(Graphics::NEED_STENCIL))
   {
     cerr << "------------ERROR-------------" << endl;
     cout << "Could not initialize graphics, not continuing." << endl;
+    Library::stop_loading();
     exit(1);
   }
 
-  BrowseMode mode;
+  //BrowseMode starts out blending the first two:
+  if (Library::wait_for_motions(2) == 0)
+  {
+    cerr << "------------ERROR-------------" << endl;
+    cerr << "Could not find any motions to browse in directory '" << path << "'.\nPlease either place amc files and associated asf here, or specify a different\n directory on on the command line." << endl;
+    Graphics::deinit();
+    SDL_Quit();
+    return 1;
+  }
+
+  {
+    BrowseMode mode(prefetch_depth);
+
+    mode.main_loop();
+  }
 
-  mode.main_loop();
+  Library::stop_loading();
 
   Graphics::deinit();
 
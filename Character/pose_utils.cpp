@@ -4,6 +4,13 @@
 
 #include <iostream>
 
+//The SIMD kernels for the batch get_world_bones are compiled with
+//per-function target attributes, as in Library/DistanceKernel.cpp.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WORLD_BONES_X86
+#include <immintrin.h>
+#endif
+
 using std::cout;
 using std::endl;
 
@@ -53,6 +60,279 @@ void get_world_bones(Pose const &pose, WorldBones &out)
   }
 }
 
+WorldBonesBlock::WorldBonesBlock() : frames(0), bones(0)
+{
+}
+
+void WorldBonesBlock::resize(unsigned int _frames, unsigned int _bones)
+{
+  frames = _frames;
+  bones = _bones;
+  bases.resize(bones * 3 * frames);
+  tips.resize(bones * 3 * frames);
+  orientations.resize(bones * 4 * frames);
+}
+
+namespace
+{
+
+//one bone over a run of frames: its parent's (or, for a bone off the root,
+//the root's) orientation and tip, and its own local orientation and offset
+//in; its world orientation, base and tip out.
+class BonePlanes
+{
+public:
+  float const *parent_orientation[4];
+  float const *parent_tip[3];
+  float const *local[4];
+  Vector3f offset;
+  float *orientation[4];
+  float *base[3];
+  float *tip[3];
+};
+
+//frame f, exactly as get_world_bones does it. The SIMD kernels below do
+//the same arithmetic in the same order, so they give the same bits.
+inline void bone_frame(BonePlanes const &p, unsigned int f)
+{
+  Quatf parent, local;
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    parent.c[c] = p.parent_orientation[c][f];
+    local.c[c] = p.local[c][f];
+  }
+  Quatf orientation = normalize(multiply(parent, local));
+  Vector3f base = make_vector(p.parent_tip[0][f], p.parent_tip[1][f], p.parent_tip[2][f]);
+  Vector3f tip = base + rotate(p.offset, orientation);
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    p.orientation[c][f] = orientation.c[c];
+  }
+  for (unsigned int c = 0; c < 3; ++c)
+  {
+    p.base[c][f] = base.c[c];
+    p.tip[c][f] = tip.c[c];
+  }
+}
+
+void bone_frames_scalar(BonePlanes const &p, unsigned int frames)
+{
+  for (unsigned int f = 0; f < frames; ++f)
+  {
+    bone_frame(p, f);
+  }
+}
+
+#ifdef WORLD_BONES_X86
+
+__attribute__((target("sse")))
+void bone_frames_sse(BonePlanes const &p, unsigned int frames)
+{
+  __m128 const zero = _mm_setzero_ps();
+  __m128 const one = _mm_set1_ps(1.0f);
+  __m128 const sign = _mm_set1_ps(-0.0f);
+  __m128 const vx = _mm_set1_ps(p.offset.x);
+  __m128 const vy = _mm_set1_ps(p.offset.y);
+  __m128 const vz = _mm_set1_ps(p.offset.z);
+  unsigned int f = 0;
+  for (; f + 4 <= frames; f += 4)
+  {
+    __m128 ax = _mm_loadu_ps(p.parent_orientation[0] + f);
+    __m128 ay = _mm_loadu_ps(p.parent_orientation[1] + f);
+    __m128 az = _mm_loadu_ps(p.parent_orientation[2] + f);
+    __m128 aw = _mm_loadu_ps(p.parent_orientation[3] + f);
+    __m128 bx = _mm_loadu_ps(p.local[0] + f);
+    __m128 by = _mm_loadu_ps(p.local[1] + f);
+    __m128 bz = _mm_loadu_ps(p.local[2] + f);
+    __m128 bw = _mm_loadu_ps(p.local[3] + f);
+
+    //multiply(parent, local):
+    __m128 qw = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(aw, bw), _mm_mul_ps(ax, bx)), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    __m128 qx = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(by, az)), _mm_mul_ps(aw, bx)), _mm_mul_ps(bw, ax));
+    __m128 qy = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(bz, ax)), _mm_mul_ps(aw, by)), _mm_mul_ps(bw, ay));
+    __m128 qz = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(bx, ay)), _mm_mul_ps(aw, bz)), _mm_mul_ps(bw, az));
+
+    //normalize (zero length -> identity):
+    __m128 len = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_mul_ps(qz, qz)), _mm_mul_ps(qw, qw));
+    __m128 degenerate = _mm_cmpeq_ps(len, zero);
+    len = _mm_sqrt_ps(len);
+    qx = _mm_andnot_ps(degenerate, _mm_div_ps(qx, len));
+    qy = _mm_andnot_ps(degenerate, _mm_div_ps(qy, len));
+    qz = _mm_andnot_ps(degenerate, _mm_div_ps(qz, len));
+    qw = _mm_or_ps(_mm_andnot_ps(degenerate, _mm_div_ps(qw, len)), _mm_and_ps(degenerate, one));
+
+    //rotate(offset, q) = multiply(q, multiply((offset, 0), conjugate(q))):
+    __m128 cx = _mm_xor_ps(qx, sign);
+    __m128 cy = _mm_xor_ps(qy, sign);
+    __m128 cz = _mm_xor_ps(qz, sign);
+    __m128 tw = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(zero, qw), _mm_mul_ps(vx, cx)), _mm_mul_ps(vy, cy)), _mm_mul_ps(vz, cz));
+    __m128 tx = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(vy, cz), _mm_mul_ps(cy, vz)), _mm_mul_ps(zero, cx)), _mm_mul_ps(qw, vx));
+    __m128 ty = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(vz, cx), _mm_mul_ps(cz, vx)), _mm_mul_ps(zero, cy)), _mm_mul_ps(qw, vy));
+    __m128 tz = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(vx, cy), _mm_mul_ps(cx, vy)), _mm_mul_ps(zero, cz)), _mm_mul_ps(qw, vz));
+    __m128 rx = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(qy, tz), _mm_mul_ps(ty, qz)), _mm_mul_ps(qw, tx)), _mm_mul_ps(tw, qx));
+    __m128 ry = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(qz, tx), _mm_mul_ps(tz, qx)), _mm_mul_ps(qw, ty)), _mm_mul_ps(tw, qy));
+    __m128 rz = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(qx, ty), _mm_mul_ps(tx, qy)), _mm_mul_ps(qw, tz)), _mm_mul_ps(tw, qz));
+
+    __m128 basex = _mm_loadu_ps(p.parent_tip[0] + f);
+    __m128 basey = _mm_loadu_ps(p.parent_tip[1] + f);
+    __m128 basez = _mm_loadu_ps(p.parent_tip[2] + f);
+    _mm_storeu_ps(p.orientation[0] + f, qx);
+    _mm_storeu_ps(p.orientation[1] + f, qy);
+    _mm_storeu_ps(p.orientation[2] + f, qz);
+    _mm_storeu_ps(p.orientation[3] + f, qw);
+    _mm_storeu_ps(p.base[0] + f, basex);
+    _mm_storeu_ps(p.base[1] + f, basey);
+    _mm_storeu_ps(p.base[2] + f, basez);
+    _mm_storeu_ps(p.tip[0] + f, _mm_add_ps(basex, rx));
+    _mm_storeu_ps(p.tip[1] + f, _mm_add_ps(basey, ry));
+    _mm_storeu_ps(p.tip[2] + f, _mm_add_ps(basez, rz));
+  }
+  //leftover frames:
+  for (; f < frames; ++f)
+  {
+    bone_frame(p, f);
+  }
+}
+
+__attribute__((target("avx")))
+void bone_frames_avx(BonePlanes const &p, unsigned int frames)
+{
+  __m256 const zero = _mm256_setzero_ps();
+  __m256 const one = _mm256_set1_ps(1.0f);
+  __m256 const sign = _mm256_set1_ps(-0.0f);
+  __m256 const vx = _mm256_set1_ps(p.offset.x);
+  __m256 const vy = _mm256_set1_ps(p.offset.y);
+  __m256 const vz = _mm256_set1_ps(p.offset.z);
+  unsigned int f = 0;
+  for (; f + 8 <= frames; f += 8)
+  {
+    __m256 ax = _mm256_loadu_ps(p.parent_orientation[0] + f);
+    __m256 ay = _mm256_loadu_ps(p.parent_orientation[1] + f);
+    __m256 az = _mm256_loadu_ps(p.parent_orientation[2] + f);
+    __m256 aw = _mm256_loadu_ps(p.parent_orientation[3] + f);
+    __m256 bx = _mm256_loadu_ps(p.local[0] + f);
+    __m256 by = _mm256_loadu_ps(p.local[1] + f);
+    __m256 bz = _mm256_loadu_ps(p.local[2] + f);
+    __m256 bw = _mm256_loadu_ps(p.local[3] + f);
+
+    //multiply(parent, local):
+    __m256 qw = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(aw, bw), _mm256_mul_ps(ax, bx)), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+    __m256 qx = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(by, az)), _mm256_mul_ps(aw, bx)), _mm256_mul_ps(bw, ax));
+    __m256 qy = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(bz, ax)), _mm256_mul_ps(aw, by)), _mm256_mul_ps(bw, ay));
+    __m256 qz = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(bx, ay)), _mm256_mul_ps(aw, bz)), _mm256_mul_ps(bw, az));
+
+    //normalize (zero length -> identity):
+    __m256 len = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(qx, qx), _mm256_mul_ps(qy, qy)), _mm256_mul_ps(qz, qz)), _mm256_mul_ps(qw, qw));
+    __m256 degenerate = _mm256_cmp_ps(len, zero, _CMP_EQ_OQ);
+    len = _mm256_sqrt_ps(len);
+    qx = _mm256_andnot_ps(degenerate, _mm256_div_ps(qx, len));
+    qy = _mm256_andnot_ps(degenerate, _mm256_div_ps(qy, len));
+    qz = _mm256_andnot_ps(degenerate, _mm256_div_ps(qz, len));
+    qw = _mm256_or_ps(_mm256_andnot_ps(degenerate, _mm256_div_ps(qw, len)), _mm256_and_ps(degenerate, one));
+
+    //rotate(offset, q) = multiply(q, multiply((offset, 0), conjugate(q))):
+    __m256 cx = _mm256_xor_ps(qx, sign);
+    __m256 cy = _mm256_xor_ps(qy, sign);
+    __m256 cz = _mm256_xor_ps(qz, sign);
+    __m256 tw = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(zero, qw), _mm256_mul_ps(vx, cx)), _mm256_mul_ps(vy, cy)), _mm256_mul_ps(vz, cz));
+    __m256 tx = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(vy, cz), _mm256_mul_ps(cy, vz)), _mm256_mul_ps(zero, cx)), _mm256_mul_ps(qw, vx));
+    __m256 ty = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(vz, cx), _mm256_mul_ps(cz, vx)), _mm256_mul_ps(zero, cy)), _mm256_mul_ps(qw, vy));
+    __m256 tz = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(vx, cy), _mm256_mul_ps(cx, vy)), _mm256_mul_ps(zero, cz)), _mm256_mul_ps(qw, vz));
+    __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(qy, tz), _mm256_mul_ps(ty, qz)), _mm256_mul_ps(qw, tx)), _mm256_mul_ps(tw, qx));
+    __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(qz, tx), _mm256_mul_ps(tz, qx)), _mm256_mul_ps(qw, ty)), _mm256_mul_ps(tw, qy));
+    __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(qx, ty), _mm256_mul_ps(tx, qy)), _mm256_mul_ps(qw, tz)), _mm256_mul_ps(tw, qz));
+
+    __m256 basex = _mm256_loadu_ps(p.parent_tip[0] + f);
+    __m256 basey = _mm256_loadu_ps(p.parent_tip[1] + f);
+    __m256 basez = _mm256_loadu_ps(p.parent_tip[2] + f);
+    _mm256_storeu_ps(p.orientation[0] + f, qx);
+    _mm256_storeu_ps(p.orientation[1] + f, qy);
+    _mm256_storeu_ps(p.orientation[2] + f, qz);
+    _mm256_storeu_ps(p.orientation[3] + f, qw);
+    _mm256_storeu_ps(p.base[0] + f, basex);
+    _mm256_storeu_ps(p.base[1] + f, basey);
+    _mm256_storeu_ps(p.base[2] + f, basez);
+    _mm256_storeu_ps(p.tip[0] + f, _mm256_add_ps(basex, rx));
+    _mm256_storeu_ps(p.tip[1] + f, _mm256_add_ps(basey, ry));
+    _mm256_storeu_ps(p.tip[2] + f, _mm256_add_ps(basez, rz));
+  }
+  //leftover frames:
+  for (; f < frames; ++f)
+  {
+    bone_frame(p, f);
+  }
+}
+
+#endif //WORLD_BONES_X86
+
+typedef void (*BoneKernel)(BonePlanes const &, unsigned int);
+
+class KernelChoice
+{
+public:
+  KernelChoice() : kernel(bone_frames_scalar), name("scalar")
+  {
+#ifdef WORLD_BONES_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+    {
+      kernel = bone_frames_avx;
+      name = "avx";
+    }
+    else if (__builtin_cpu_supports("sse"))
+    {
+      kernel = bone_frames_sse;
+      name = "sse";
+    }
+#endif
+  }
+  BoneKernel kernel;
+  char const *name;
+};
+
+KernelChoice const &get_kernel()
+{
+  static KernelChoice choice;
+  return choice;
+}
+
+}
+
+void get_world_bones(Library::PoseBlock const &poses, WorldBonesBlock &out)
+{
+  out.resize(poses.frames, poses.bones);
+  if (poses.frames == 0) return;
+  assert(poses.skeleton);
+  vector< Library::Bone > const &bones = poses.skeleton->bones;
+  assert(bones.size() == poses.bones);
+  BoneKernel kernel = get_kernel().kernel;
+  for (unsigned int b = 0; b < bones.size(); ++b)
+  {
+    int parent = bones[b].parent;
+    assert(parent < (int)b);
+    BonePlanes planes;
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      planes.parent_orientation[c] = (parent < 0 ? poses.orientation(0, c) : out.orientation(parent, c));
+      planes.local[c] = poses.orientation(b + 1, c);
+      planes.orientation[c] = out.orientation(b, c);
+    }
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+      planes.parent_tip[c] = (parent < 0 ? poses.root_position(c) : out.tip(parent, c));
+      planes.base[c] = out.base(b, c);
+      planes.tip[c] = out.tip(b, c);
+    }
+    planes.offset = make_vector< float >(bones[b].direction * bones[b].length);
+    kernel(planes, poses.frames);
+  }
+}
+
+char const *world_bones_kernel_name()
+{
+  return get_kernel().name;
+}
+
 float world_distance(WorldBones &a, WorldBones &b)
 {
   assert(a.tips.size() == b.tips.size());
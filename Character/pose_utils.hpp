@@ -3,6 +3,13 @@
 
 #include "Character.hpp"
 
+#include <assert.h>
+
+namespace Library
+{
+class PoseBlock;
+}
+
 namespace Character
 {
 
@@ -16,6 +23,85 @@ public:
 
 void get_world_bones(Pose const &pose, WorldBones &out);
 
+//world bones for every pose in a Library::PoseBlock, laid out like the
+//block: one plane of 'frames' floats per component.
+class WorldBonesBlock
+{
+public:
+  WorldBonesBlock();
+  //keeps its storage, like PoseBlock::resize.
+  void resize(unsigned int frames, unsigned int bones);
+
+  //component c (x, y, z) of bone b's base and tip, one value per frame:
+  inline float *base(unsigned int b, unsigned int c)
+  {
+    assert(b < bones && c < 3 && frames);
+    return &(bases[(b * 3 + c) * frames]);
+  }
+  inline float const *base(unsigned int b, unsigned int c) const
+  {
+    assert(b < bones && c < 3 && frames);
+    return &(bases[(b * 3 + c) * frames]);
+  }
+  inline float *tip(unsigned int b, unsigned int c)
+  {
+    assert(b < bones && c < 3 && frames);
+    return &(tips[(b * 3 + c) * frames]);
+  }
+  inline float const *tip(unsigned int b, unsigned int c) const
+  {
+    assert(b < bones && c < 3 && frames);
+    return &(tips[(b * 3 + c) * frames]);
+  }
+  //component c (x, y, z, w) of bone b's orientation:
+  inline float *orientation(unsigned int b, unsigned int c)
+  {
+    assert(b < bones && c < 4 && frames);
+    return &(orientations[(b * 4 + c) * frames]);
+  }
+  inline float const *orientation(unsigned int b, unsigned int c) const
+  {
+    assert(b < bones && c < 4 && frames);
+    return &(orientations[(b * 4 + c) * frames]);
+  }
+
+  //one frame's worth:
+  inline Vector3f base_at(unsigned int b, unsigned int frame) const
+  {
+    return make_vector(base(b, 0)[frame], base(b, 1)[frame], base(b, 2)[frame]);
+  }
+  inline Vector3f tip_at(unsigned int b, unsigned int frame) const
+  {
+    return make_vector(tip(b, 0)[frame], tip(b, 1)[frame], tip(b, 2)[frame]);
+  }
+  inline Quatf orientation_at(unsigned int b, unsigned int frame) const
+  {
+    Quatf ret;
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      ret.c[c] = orientation(b, c)[frame];
+    }
+    return ret;
+  }
+
+  unsigned int frames;
+  unsigned int bones;
+
+private:
+  vector< float > bases;
+  vector< float > tips;
+  vector< float > orientations;
+};
+
+//exactly what get_world_bones gives for each pose in the block, but
+//worked out a bone at a time across many frames at once (8 per step with
+//AVX, 4 with SSE; picked the first time it's called). Relies on parents
+//coming before their children, as Skeleton::check_parse orders them.
+void get_world_bones(Library::PoseBlock const &poses, WorldBonesBlock &out);
+
+//the name of the implementation that uses ("avx", "sse", "scalar").
+char const *world_bones_kernel_name();
+
 float world_distance(WorldBones &a, WorldBones &b);
 
 void lower_to_ground(Pose const &pose);
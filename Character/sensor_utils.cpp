@@ -240,14 +240,19 @@ void slurp_motion_data(int motion, vector< vector< Vector3f > > &wb_bases, vecto
   const Library::Motion &m = Library::motion(motion);
   vector< vector< Vector3f > > bases(m.frames());
   vector< vector< Quatf > > orientations(m.frames());
+  Library::PoseBlock block;
+  m.get_poses(0, m.frames(), block);
+  Character::WorldBonesBlock wb;
+  get_world_bones(block, wb);
   for (unsigned int f = 0; f < m.frames(); f++)
   {
-    Character::Pose p;
-    m.get_pose(f, p);
-    Character::WorldBones wb;
-    get_world_bones(p, wb);
-    bases[f] = wb.bases;
-    orientations[f] = wb.orientations;
+    bases[f].resize(wb.bones);
+    orientations[f].resize(wb.bones);
+    for (unsigned int b = 0; b < wb.bones; ++b)
+    {
+      bases[f][b] = wb.base_at(b, f);
+      orientations[f][b] = wb.orientation_at(b, f);
+    }
   }
   wb_bases = bases;
   wb_orientations = orientations;
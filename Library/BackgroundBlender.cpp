@@ -0,0 +1,203 @@
+#include "Library/BackgroundBlender.hpp"
+
+#include <SDL_thread.h>
+
+#include <cassert>
+
+namespace Library
+{
+
+bool BackgroundBlender::Request::operator== (const Request &other) const
+{
+  return from == other.from && to == other.to && method == other.method;
+}
+
+BackgroundBlender::BackgroundBlender()
+: thread(NULL),
+  running(false),
+  queued(false),
+  building(false),
+  built(NULL)
+{
+  lock = SDL_CreateMutex();
+  finished = SDL_CreateCond();
+  assert(lock != NULL);
+  assert(finished != NULL);
+}
+
+BackgroundBlender::~BackgroundBlender()
+{
+  // Nothing more to build, but the one under way can't be stopped
+  SDL_LockMutex(lock);
+  bool dropped = queued;
+  Request drop = next;
+  queued = false;
+  SDL_UnlockMutex(lock);
+  if(dropped) unpinMotions(drop);
+
+  if(thread != NULL) SDL_WaitThread(thread, NULL);
+
+  if(built != NULL) unpinMotions(built_request);
+  delete built;
+  SDL_DestroyCond(finished);
+  SDL_DestroyMutex(lock);
+}
+
+void BackgroundBlender::start(const Motion *f, const Motion *t,
+                              DistanceMap::PathMethod method)
+{
+  Request request;
+  request.from = f;
+  request.to = t;
+  request.method = method;
+
+  // Before anything of ours is locked, since this may have to load them
+  pin(*f);
+  pin(*t);
+
+  SDL_LockMutex(lock);
+
+  if((built != NULL && built_request == request) ||
+     (building && current == request && !queued))
+  {
+    SDL_UnlockMutex(lock);
+    unpinMotions(request);
+    return;
+  }
+
+  bool dropped = queued;
+  Request drop = next;
+  next = request;
+  queued = true;
+
+  if(!running)
+  {
+    // The last thread (if any) has run out of work and is on its way out
+    if(thread != NULL) SDL_WaitThread(thread, NULL);
+    thread = SDL_CreateThread(workerMain, this);
+    running = (thread != NULL);
+    if(!running)
+    {
+      // take() will say it isn't coming
+      queued = false;
+      SDL_UnlockMutex(lock);
+      unpinMotions(request);
+      return;
+    }
+  }
+
+  SDL_UnlockMutex(lock);
+  if(dropped) unpinMotions(drop);
+}
+
+bool BackgroundBlender::ready(const Motion *f, const Motion *t,
+                              DistanceMap::PathMethod method)
+{
+  Request request;
+  request.from = f;
+  request.to = t;
+  request.method = method;
+
+  SDL_LockMutex(lock);
+  bool is_ready = (built != NULL && built_request == request);
+  SDL_UnlockMutex(lock);
+  return is_ready;
+}
+
+bool BackgroundBlender::take(const Motion *f, const Motion *t,
+                             LerpBlender &into, DistanceMap::PathMethod method)
+{
+  Request request;
+  request.from = f;
+  request.to = t;
+  request.method = method;
+
+  SDL_LockMutex(lock);
+  while(true)
+  {
+    if(built != NULL && built_request == request)
+    {
+      // Only the blender's insides change hands; nothing is copied
+      into.swap(*built);
+      delete built;
+      built = NULL;
+      SDL_UnlockMutex(lock);
+      unpinMotions(request);
+      return true;
+    }
+
+    bool coming = (queued && next == request) ||
+                  (building && current == request);
+    if(!coming)
+    {
+      SDL_UnlockMutex(lock);
+      return false;
+    }
+
+    SDL_CondWait(finished, lock);
+  }
+}
+
+bool BackgroundBlender::advance(LerpBlender &blender, const Motion *m)
+{
+  // Copying a blender doesn't copy its distances, so this is cheap
+  LerpBlender next(blender);
+  if(!take(blender.getToMotion(), m, next, blender.getPathMethod()))
+  {
+    next = LerpBlender::blendFromBlend(blender, m);
+    blender.swap(next);
+    return false;
+  }
+
+  next.followOn(blender);
+  blender.swap(next);
+  return true;
+}
+
+void BackgroundBlender::unpinMotions(const Request &request)
+{
+  unpin(*request.from);
+  unpin(*request.to);
+}
+
+int BackgroundBlender::workerMain(void *data)
+{
+  BackgroundBlender &self = *(BackgroundBlender *) data;
+
+  SDL_LockMutex(self.lock);
+  while(self.queued)
+  {
+    self.current = self.next;
+    self.queued = false;
+    self.building = true;
+    SDL_UnlockMutex(self.lock);
+
+    // The slow part, with nothing locked
+    LerpBlender *blender = new LerpBlender(self.current.from,
+                                           self.current.to,
+                                           self.current.method);
+
+    SDL_LockMutex(self.lock);
+    bool replaced = (self.built != NULL);
+    Request old = self.built_request;
+    delete self.built;
+    self.built = blender;
+    self.built_request = self.current;
+    self.building = false;
+    SDL_CondBroadcast(self.finished);
+
+    // Nobody took the last one, and now nobody will
+    if(replaced)
+    {
+      SDL_UnlockMutex(self.lock);
+      unpinMotions(old);
+      SDL_LockMutex(self.lock);
+    }
+  }
+  self.running = false;
+  SDL_UnlockMutex(self.lock);
+
+  return 0;
+}
+
+}
@@ -0,0 +1,87 @@
+#ifndef __BACKGROUNDBLENDER_H__
+#define __BACKGROUNDBLENDER_H__
+
+#include <Library/Library.hpp>
+#include <Library/LerpBlender.hpp>
+#include <Library/DistanceMap.hpp>
+
+struct SDL_Thread;
+struct SDL_mutex;
+struct SDL_cond;
+
+namespace Library
+{
+
+/* Builds LerpBlenders on a background thread, so the distance map and path
+ * for the next blend can be worked out while the current one plays.  Only
+ * the most recently asked for blend matters: asking for another while one
+ * is being built queues it up to be built next, replacing anything queued
+ * before it.  A blend's two motions stay pinned from start() until it's
+ * taken or dropped, so the library can't unload them while they're read;
+ * whoever takes one should have them pinned too. */
+class BackgroundBlender
+{
+public:
+  BackgroundBlender();
+
+  /* Waits for the blend being built (if any) to finish */
+  ~BackgroundBlender();
+
+  /* Starts building the blend from f to t, unless it's already built or
+   * being built.  Returns straight away. */
+  void start(const Motion *f, const Motion *t,
+             DistanceMap::PathMethod method = DistanceMap::GreedyPath);
+
+  /* True once the blend from f to t is built and waiting to be taken */
+  bool ready(const Motion *f, const Motion *t,
+             DistanceMap::PathMethod method = DistanceMap::GreedyPath);
+
+  /* Swaps the blend from f to t into 'into', waiting for it if it's still
+   * being built.  Returns false, leaving 'into' alone, if that blend wasn't
+   * started. */
+  bool take(const Motion *f, const Motion *t, LerpBlender &into,
+            DistanceMap::PathMethod method = DistanceMap::GreedyPath);
+
+  /* Moves blender on to the blend from its to motion into m, just like
+   * blender = LerpBlender::blendFromBlend(blender, m), but using the blend
+   * from start() if there is one.  Returns false if it had to build the
+   * blend on the spot. */
+  bool advance(LerpBlender &blender, const Motion *m);
+
+private:
+  BackgroundBlender(const BackgroundBlender &);
+  BackgroundBlender& operator= (const BackgroundBlender &);
+
+  /* Which blend, from what to what */
+  struct Request
+  {
+    const Motion *from;
+    const Motion *to;
+    DistanceMap::PathMethod method;
+    bool operator== (const Request &other) const;
+  };
+
+  static int workerMain(void *data);
+
+  /* Lets go of the pins start() put on a request's motions */
+  static void unpinMotions(const Request &request);
+
+  /* Everything below is guarded by lock */
+  SDL_mutex *lock;
+  SDL_cond *finished; // signalled whenever a blend is built
+
+  SDL_Thread *thread;
+  bool running;       // thread is working through requests
+
+  bool queued;        // 'next' is waiting to be built
+  Request next;
+  bool building;      // 'current' is being built right now
+  Request current;
+
+  LerpBlender *built; // the last blend built, until it's taken
+  Request built_request;
+};
+
+}
+
+#endif
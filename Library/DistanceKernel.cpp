@@ -0,0 +1,223 @@
+#include "DistanceKernel.hpp"
+
+#include <assert.h>
+
+//The SIMD versions are compiled with per-function target attributes, so the
+//rest of the build doesn't need -mavx and the choice can be made at runtime.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DISTANCE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace Library
+{
+
+namespace
+{
+
+//Each kernel compares four rows of a against one row of b at a time, so
+//every load from b is used four times.
+
+void squared_distances_scalar(float const *a, unsigned int a_rows,
+                              float const *b, unsigned int b_rows,
+                              unsigned int stride, float *out, unsigned int out_stride)
+{
+  for (unsigned int i = 0; i < a_rows; ++i)
+  {
+    float const *ar = a + i * stride;
+    for (unsigned int j = 0; j < b_rows; ++j)
+    {
+      float const *br = b + j * stride;
+      float sum[DistanceKernelWidth] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+      for (unsigned int k = 0; k < stride; k += DistanceKernelWidth)
+      {
+        for (unsigned int l = 0; l < DistanceKernelWidth; ++l)
+        {
+          float d = ar[k + l] - br[k + l];
+          sum[l] += d * d;
+        }
+      }
+      out[i * out_stride + j] = ((sum[0] + sum[4]) + (sum[1] + sum[5]))
+                              + ((sum[2] + sum[6]) + (sum[3] + sum[7]));
+    }
+  }
+}
+
+#ifdef DISTANCE_KERNEL_X86
+
+__attribute__((target("sse")))
+inline float horizontal_sum_sse(__m128 v)
+{
+  __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+  return _mm_cvtss_f32(t);
+}
+
+__attribute__((target("sse")))
+void squared_distances_sse(float const *a, unsigned int a_rows,
+                           float const *b, unsigned int b_rows,
+                           unsigned int stride, float *out, unsigned int out_stride)
+{
+  unsigned int i = 0;
+  for (; i + 4 <= a_rows; i += 4)
+  {
+    float const *a0 = a + i * stride;
+    float const *a1 = a0 + stride;
+    float const *a2 = a1 + stride;
+    float const *a3 = a2 + stride;
+    for (unsigned int j = 0; j < b_rows; ++j)
+    {
+      float const *br = b + j * stride;
+      __m128 s0 = _mm_setzero_ps();
+      __m128 s1 = _mm_setzero_ps();
+      __m128 s2 = _mm_setzero_ps();
+      __m128 s3 = _mm_setzero_ps();
+      for (unsigned int k = 0; k < stride; k += 4)
+      {
+        __m128 bv = _mm_loadu_ps(br + k);
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a0 + k), bv);
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a1 + k), bv);
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(a2 + k), bv);
+        __m128 d3 = _mm_sub_ps(_mm_loadu_ps(a3 + k), bv);
+        s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+        s2 = _mm_add_ps(s2, _mm_mul_ps(d2, d2));
+        s3 = _mm_add_ps(s3, _mm_mul_ps(d3, d3));
+      }
+      out[(i + 0) * out_stride + j] = horizontal_sum_sse(s0);
+      out[(i + 1) * out_stride + j] = horizontal_sum_sse(s1);
+      out[(i + 2) * out_stride + j] = horizontal_sum_sse(s2);
+      out[(i + 3) * out_stride + j] = horizontal_sum_sse(s3);
+    }
+  }
+  //leftover rows of a:
+  for (; i < a_rows; ++i)
+  {
+    float const *ar = a + i * stride;
+    for (unsigned int j = 0; j < b_rows; ++j)
+    {
+      float const *br = b + j * stride;
+      __m128 s = _mm_setzero_ps();
+      for (unsigned int k = 0; k < stride; k += 4)
+      {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(ar + k), _mm_loadu_ps(br + k));
+        s = _mm_add_ps(s, _mm_mul_ps(d, d));
+      }
+      out[i * out_stride + j] = horizontal_sum_sse(s);
+    }
+  }
+}
+
+__attribute__((target("avx")))
+inline float horizontal_sum_avx(__m256 v)
+{
+  __m128 t = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+  t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+  return _mm_cvtss_f32(t);
+}
+
+__attribute__((target("avx")))
+void squared_distances_avx(float const *a, unsigned int a_rows,
+                           float const *b, unsigned int b_rows,
+                           unsigned int stride, float *out, unsigned int out_stride)
+{
+  unsigned int i = 0;
+  for (; i + 4 <= a_rows; i += 4)
+  {
+    float const *a0 = a + i * stride;
+    float const *a1 = a0 + stride;
+    float const *a2 = a1 + stride;
+    float const *a3 = a2 + stride;
+    for (unsigned int j = 0; j < b_rows; ++j)
+    {
+      float const *br = b + j * stride;
+      __m256 s0 = _mm256_setzero_ps();
+      __m256 s1 = _mm256_setzero_ps();
+      __m256 s2 = _mm256_setzero_ps();
+      __m256 s3 = _mm256_setzero_ps();
+      for (unsigned int k = 0; k < stride; k += 8)
+      {
+        __m256 bv = _mm256_loadu_ps(br + k);
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a0 + k), bv);
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a1 + k), bv);
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a2 + k), bv);
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a3 + k), bv);
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(d0, d0));
+        s1 = _mm256_add_ps(s1, _mm256_mul_ps(d1, d1));
+        s2 = _mm256_add_ps(s2, _mm256_mul_ps(d2, d2));
+        s3 = _mm256_add_ps(s3, _mm256_mul_ps(d3, d3));
+      }
+      out[(i + 0) * out_stride + j] = horizontal_sum_avx(s0);
+      out[(i + 1) * out_stride + j] = horizontal_sum_avx(s1);
+      out[(i + 2) * out_stride + j] = horizontal_sum_avx(s2);
+      out[(i + 3) * out_stride + j] = horizontal_sum_avx(s3);
+    }
+  }
+  //leftover rows of a:
+  for (; i < a_rows; ++i)
+  {
+    float const *ar = a + i * stride;
+    for (unsigned int j = 0; j < b_rows; ++j)
+    {
+      float const *br = b + j * stride;
+      __m256 s = _mm256_setzero_ps();
+      for (unsigned int k = 0; k < stride; k += 8)
+      {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(ar + k), _mm256_loadu_ps(br + k));
+        s = _mm256_add_ps(s, _mm256_mul_ps(d, d));
+      }
+      out[i * out_stride + j] = horizontal_sum_avx(s);
+    }
+  }
+}
+
+#endif //DISTANCE_KERNEL_X86
+
+typedef void (*DistanceKernel)(float const *, unsigned int, float const *, unsigned int, unsigned int, float *, unsigned int);
+
+class KernelChoice
+{
+public:
+  KernelChoice() : kernel(squared_distances_scalar), name("scalar")
+  {
+#ifdef DISTANCE_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+    {
+      kernel = squared_distances_avx;
+      name = "avx";
+    }
+    else if (__builtin_cpu_supports("sse"))
+    {
+      kernel = squared_distances_sse;
+      name = "sse";
+    }
+#endif
+  }
+  DistanceKernel kernel;
+  char const *name;
+};
+
+KernelChoice const &get_kernel()
+{
+  static KernelChoice choice;
+  return choice;
+}
+
+}
+
+void squared_distances(float const *a, unsigned int a_rows,
+                       float const *b, unsigned int b_rows,
+                       unsigned int stride, float *out, unsigned int out_stride)
+{
+  assert(stride % DistanceKernelWidth == 0);
+  get_kernel().kernel(a, a_rows, b, b_rows, stride, out, out_stride);
+}
+
+char const *distance_kernel_name()
+{
+  return get_kernel().name;
+}
+
+} //namespace Library
@@ -0,0 +1,23 @@
+#ifndef DISTANCEKERNEL_HPP
+#define DISTANCEKERNEL_HPP
+
+namespace Library
+{
+
+//rows passed to squared_distances must be padded (with zeros) to a
+//multiple of this many floats:
+const unsigned int DistanceKernelWidth = 8;
+
+//for every row i of a and row j of b, store the squared euclidean distance
+//between them into out[i * out_stride + j]. Rows are 'stride' floats apart.
+// - picks an AVX, SSE or plain C++ implementation the first time it's called.
+void squared_distances(float const *a, unsigned int a_rows,
+                       float const *b, unsigned int b_rows,
+                       unsigned int stride, float *out, unsigned int out_stride);
+
+//the name of the implementation squared_distances uses ("avx", "sse", "scalar").
+char const *distance_kernel_name();
+
+} //namespace Library
+
+#endif //DISTANCEKERNEL_HPP
@@ -1,14 +1,30 @@
 #include <Library/DistanceMap.hpp>
-#include <Graphics/Graphics.hpp>
-#include <Vector/VectorGL.hpp>
-#include <Vector/QuatGL.hpp>
+#include <Library/DistanceKernel.hpp>
+#include <Library/Parallel.hpp>
+#include <Library/FileView.hpp>
+#include <Character/pose_utils.hpp>
 
 #include <cstring>
+#include <cstdio>
 #include <cassert>
 #include <algorithm>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 
 #define UNINITIALIZED -1.0f
 
+// Number of frames along each side of a tile in populate()
+#define TILE_SIZE 64u
+
+// The Kristine Slot paper suggests a slope limit of 3 frames
+#define SLOPE_LIMIT 3u
+
+// Ways to arrive at a cell in calcOptimalPath: diagonally, or by any of up to
+// SLOPE_LIMIT horizontal or vertical steps in a row
+#define N_STATES (2 * SLOPE_LIMIT + 1)
+
 using namespace Character;
 using namespace std;
 
@@ -19,37 +35,80 @@ DistanceMap::DistanceMap(const Motion *f, const Motion *t)
 : from(f),
   to(t)
 {
-  distances = new float[from->frames() * to->frames()];
-  for(unsigned int i = 0; i < from->frames() * to->frames(); ++i)
-    distances[i] = UNINITIALIZED;
+  // Mustn't have null motions
+  assert(from != NULL);
+  assert(to != NULL);
+
+  // Store every cell
+  window_begin = 0;
+  band_begin.assign(from->frames(), 0);
+  band_end.assign(from->frames(), to->frames());
+  allocate();
+}
 
+DistanceMap::DistanceMap(const Motion *f, const Motion *t,
+                         unsigned int n_interp_frames)
+: from(f),
+  to(t)
+{
   // Mustn't have null motions
   assert(from != NULL);
   assert(to != NULL);
+
+  /* Only store the cells calcShortestPath(n_interp_frames) can ask for.
+   * It doesn't look at any distances before windowBegin(), and from there
+   * the slope limit bounds how fast to_frame can move compared to
+   * from_frame:
+   *  - each from frame adds at most SLOPE_LIMIT + 1 to frames, so on row r
+   *    of the window the path is below to frame (SLOPE_LIMIT + 1) * (r + 1)
+   *  - every SLOPE_LIMIT + 1 from frames add at least one to frame, so on
+   *    row r the path is at or above to frame r / (SLOPE_LIMIT + 1)
+   * The bounds below leave one cell of slack for the neighbours the path
+   * looks at.  If to is too short for the path (calcShortestPath goes
+   * greedy then), rows it runs out on are left empty. */
+  window_begin = windowBegin(n_interp_frames);
+  for(unsigned int row = 0; window_begin + row < from->frames(); ++row)
+  {
+    unsigned int low = row / (SLOPE_LIMIT + 1);
+    band_end.push_back(min(to->frames(), (SLOPE_LIMIT + 1) * (row + 1) + 1));
+    band_begin.push_back(min(low > 0 ? low - 1 : 0, band_end.back()));
+  }
+  allocate();
 }
 
 DistanceMap::DistanceMap(const DistanceMap &other)
-: shortest_path(other.shortest_path),
+: shared(other.shared),
+  distances(other.distances),
+  shortest_path(other.shortest_path),
+  window_begin(other.window_begin),
+  band_begin(other.band_begin),
+  band_end(other.band_end),
+  band_offset(other.band_offset),
+  n_cells(other.n_cells),
   from(other.from),
   to(other.to)
 {
-  distances = new float[from->frames() * to->frames()];
-  memcpy(distances, other.distances, 
-         from->frames() * to->frames() * sizeof(float));
+  // The cells stay where they are until one of us changes them
+  ++shared->refcount;
 }
 
 DistanceMap& DistanceMap::operator= (const DistanceMap &other)
 {
   if(this == &other) return *this;
 
-  delete[] distances;
+  ++other.shared->refcount;
+  release();
+  shared = other.shared;
+  distances = other.distances;
 
   from = other.from;
   to = other.to;
 
-  distances = new float[from->frames() * to->frames()];
-  memcpy(distances, other.distances, 
-         from->frames() * to->frames() * sizeof(float));
+  window_begin = other.window_begin;
+  band_begin = other.band_begin;
+  band_end = other.band_end;
+  band_offset = other.band_offset;
+  n_cells = other.n_cells;
 
   shortest_path = other.shortest_path;
 
@@ -58,156 +117,381 @@ DistanceMap& DistanceMap::operator= (const DistanceMap &other)
 
 DistanceMap::~DistanceMap()
 {
-  delete[] distances;
+  release();
+}
+
+void DistanceMap::swap(DistanceMap &other)
+{
+  std::swap(shared, other.shared);
+  std::swap(distances, other.distances);
+  shortest_path.swap(other.shortest_path);
+  std::swap(window_begin, other.window_begin);
+  band_begin.swap(other.band_begin);
+  band_end.swap(other.band_end);
+  band_offset.swap(other.band_offset);
+  std::swap(n_cells, other.n_cells);
+  std::swap(from, other.from);
+  std::swap(to, other.to);
+}
+
+void DistanceMap::release()
+{
+  assert(shared->refcount > 0);
+  if(--shared->refcount == 0)
+  {
+    delete[] shared->cells;
+    delete shared;
+  }
+}
+
+void DistanceMap::unshare()
+{
+  if(shared->refcount == 1) return;
+
+  SharedCells *own = new SharedCells;
+  own->refcount = 1;
+  own->cells = new float[n_cells];
+  memcpy(own->cells, distances, n_cells * sizeof(float));
+
+  release();
+  shared = own;
+  distances = own->cells;
+}
+
+void DistanceMap::allocate()
+{
+  assert(band_begin.size() == band_end.size());
+
+  band_offset.clear();
+  n_cells = 0;
+  for(unsigned int row = 0; row < band_begin.size(); ++row)
+  {
+    assert(band_begin[row] <= band_end[row]);
+    band_offset.push_back(n_cells);
+    n_cells += band_end[row] - band_begin[row];
+  }
+
+  shared = new SharedCells;
+  shared->refcount = 1;
+  shared->cells = distances = new float[n_cells];
+  for(unsigned int i = 0; i < n_cells; ++i)
+    distances[i] = UNINITIALIZED;
+}
+
+unsigned int DistanceMap::windowBegin(unsigned int n_interp_frames) const
+{
+  // calcShortestPath just plays the from animation up to here
+  if(n_interp_frames > 0 && n_interp_frames + 1 < from->frames())
+    return from->frames() - 1 - n_interp_frames;
+  return 0;
+}
+
+float* DistanceMap::findCell(unsigned int from_frame, unsigned int to_frame)
+{
+  assert(from_frame < from->frames());
+  assert(to_frame < to->frames());
+
+  if(from_frame < window_begin) return NULL;
+  unsigned int row = from_frame - window_begin;
+  if(to_frame < band_begin[row] || to_frame >= band_end[row]) return NULL;
+  return &(distances[band_offset[row] + (to_frame - band_begin[row])]);
+}
+
+unsigned int DistanceMap::storedCells() const
+{
+  return n_cells;
 }
 
 float* DistanceMap::getDistance(unsigned int from_frame, unsigned int to_frame)
 {
 
   // Determine the address of the distance in the map.  If it's already been
-  // initialized, we can return the value immediately.
-  float *addr =  &(distances[from_frame + to_frame * from->frames()]);
-  if(*addr != UNINITIALIZED) return addr;
+  // initialized, we can return the value immediately.  Cells outside the
+  // band of a banded map are worked out every time and not kept.
+  float *addr = findCell(from_frame, to_frame);
+  if(addr == NULL)
+  {
+    addr = &outside_band;
+  }
+  else if(*addr != UNINITIALIZED)
+  {
+    return addr;
+  }
+  else if(shared->refcount > 1)
+  {
+    // About to fill in a cell other copies of the map can see
+    unshare();
+    addr = findCell(from_frame, to_frame);
+  }
 
-  // If the distance is uninitialized, we need to calculate the distance
-  // between the two frames.  First initialize and clear from and to poses
-  Pose from_pose;
-  Pose to_pose;
-  from_pose.clear();
-  to_pose.clear();
+  /* TODO: these distances should probably be weighted according to the
+   * length or density, or perhaps most logically weight 
+   * (volume * density) of the bones, so that distance between large 
+   * bones is "more important" than distance between small bones when
+   * when calculating the shortest path. */
+  float distance = 0.0f;
 
-  vector<Vector3f> from_pos_vector;
-  vector<Vector3f> to_pos_vector;
+  if(!from->joint_positions.empty() && !to->joint_positions.empty())
+  {
+    // Both motions have their joint positions precomputed (Motion::load does
+    // this), so the distance is just a sum over two rows.
+    assert(from->joint_stride() == to->joint_stride());
 
-  from_pos_vector.clear();
-  to_pos_vector.clear();
+    // Same kernel as populate(), so lazily and eagerly computed cells agree
+    squared_distances(to->get_joint_positions(to_frame), 1,
+                      from->get_joint_positions(from_frame), 1,
+                      from->joint_stride(), &distance, 1);
+  }
+  else
+  {
+    // Otherwise we need to build both poses and find their joint positions.
+    Pose from_pose;
+    Pose to_pose;
+    from_pose.clear();
+    to_pose.clear();
 
-  from->get_pose(from_frame, from_pose);
-  to->get_pose(to_frame, to_pose);
+    vector<Vector3f> from_pos_vector;
+    vector<Vector3f> to_pos_vector;
 
-  getJointPositions(from_pose, from_pos_vector);
-  getJointPositions(to_pose, to_pos_vector);
+    from->get_pose(from_frame, from_pose);
+    to->get_pose(to_frame, to_pose);
 
-  assert(from_pos_vector.size() == to_pos_vector.size());
+    getJointPositions(from_pose, from_pos_vector);
+    getJointPositions(to_pose, to_pos_vector);
 
-  for(unsigned int k = 0; k < from_pos_vector.size(); ++k)
-  {
-    /* TODO: these distances should probably be weighted according to the
-     * length or density, or perhaps most logically weight 
-     * (volume * density) of the bones, so that distance between large 
-     * bones is "more important" than distance between small bones when
-     * when calculating the shortest path. */
-    *addr += length_squared(from_pos_vector[k] - to_pos_vector[k]);
+    assert(from_pos_vector.size() == to_pos_vector.size());
+
+    for(unsigned int k = 0; k < from_pos_vector.size(); ++k)
+    {
+      distance += length_squared(from_pos_vector[k] - to_pos_vector[k]);
+    }
   }
 
+  *addr = distance;
   return addr;
 }
 
-void DistanceMap::getJointPositions(Pose const &pose, 
-                                    vector<Vector3f> &positions) const
+namespace
 {
 
-  /* This code is mostly copypasta'd from Chracter/Draw.cpp, because we're using
-   * OpenGL to calculate the joint positions from the ModelView matrix.  This is
-   * kind of a huge hack, but it's also the fastest and easiest way I can think
-   * of to do this. 
-   *
-   * Update Apr 22 2012: I thought I had read the USING file before, but I was
-   * mistaken.  Lesson learned: be sure to read the relevant documentation
-   * first.  As it turns out, Character::WorldBones from pose_utils.hpp provides
-   * a function to get the base and tip of each bone in the skeleton using a
-   * much more sensible method.  Don't have time to change and test it at
-   * the moment. TODO: Should change this to use Character::WorldBones instead
-   * of a stupid OpenGL matrix reading hack. */
-
-  glPushMatrix();
-  
-  /* IGNORING root position and orientation.  Not sure if this is actually okay
-   * to do
-  glTranslate(state.position);
-  glRotatef(state.orientation * 180.0f / (float)M_PI, 0.0f, 1.0f, 0.0f);
-  glTranslate(pose.root_position);
-  glRotate(pose.root_orientation); */
-
-  vector< int > parent_stack;
-  parent_stack.push_back(-1);
-  for (unsigned int b = 0; b < pose.bone_orientations.size(); ++b)
-  {
-    while(!parent_stack.empty() && parent_stack.back() != pose.skeleton->bones[b].parent)
-    {
-      glPopMatrix();
-      parent_stack.pop_back();
-    }
-    assert(!parent_stack.empty());
+/* Splits the map into TILE_SIZE * TILE_SIZE tiles for parallel_for. */
+class PopulateJob : public ParallelJob
+{
+public:
+  PopulateJob(DistanceMap &m, unsigned int n_from, unsigned int n_to)
+  : map(m),
+    from_tiles((n_from + TILE_SIZE - 1) / TILE_SIZE),
+    to_tiles((n_to + TILE_SIZE - 1) / TILE_SIZE)
+  {
+  }
 
-    glPushMatrix();
-    glRotate(pose.bone_orientations[b]);
+  virtual void run(unsigned int piece)
+  {
+    map.populateTile((piece % from_tiles) * TILE_SIZE,
+                     (piece / from_tiles) * TILE_SIZE);
+  }
 
-    Vector3d t = pose.skeleton->bones[b].direction;
-    Vector3d t2;
+  unsigned int count() const { return from_tiles * to_tiles; }
 
-    if (t.x == t.y && t.y == t.z)
-    {
-      t2 = normalize(cross_product(t, make_vector(t.y,t.z,-t.x)));
-    }
-    else
-    {
-      t2 = normalize(cross_product(t, make_vector(t.y,t.z,t.x)));
-    }
+private:
+  DistanceMap &map;
+  unsigned int from_tiles;
+  unsigned int to_tiles;
+};
 
-    Vector3d t3 = cross_product(t2, t);
-    glPushMatrix();
-    double mat[16] =
-    {
-      t2.x, t2.y, t2.z, 0,
-      t3.x, t3.y, t3.z, 0,
-      t.x, t.y, t.z, 0,
-      0,0,0,1
-    };
-    glMultMatrixd(mat);
-    
-    float mv[16];
-    glGetFloatv(GL_MODELVIEW_MATRIX, mv);
-    positions.push_back(make_vector(mv[12], mv[13], mv[14]));
-
-    /* Fairly certain the rotate/translate calls in this block are 
-     * unnecessary for getting joint positions (I think they cancel
-     * each other out), but I'm leaving them in
-     * for now to be safe */
+/* Adds the cells of a row of window costs that are smaller than the cells
+ * around them to candidates.  above and below are the rows on either side,
+ * or NULL at the edges.  Ties go to the cell that comes first. */
+void addLocalMinima(const float *above, const float *row, const float *below,
+                    unsigned int from_frame, unsigned int cols,
+                    vector<DistanceMap::Transition> &candidates)
+{
+  for(unsigned int j = 0; j < cols; ++j)
+  {
+    float c = row[j];
+    unsigned int j_lo = (j > 0) ? j - 1 : j;
+    unsigned int j_hi = (j + 1 < cols) ? j + 1 : j;
+
+    if(j > 0 && !(c < row[j - 1])) continue;
+    if(j + 1 < cols && !(c <= row[j + 1])) continue;
+
+    bool minimum = true;
+    for(unsigned int n = j_lo; minimum && n <= j_hi; ++n)
     {
-      /*
-      gluCylinder(quad, pose.skeleton->bones[b].radius, 
-                  pose.skeleton->bones[b].radius, 
-                  pose.skeleton->bones[b].length, detail?16:8, 1); 
-      */
-      glRotated(180,1,0,0);
-      //gluDisk(quad, 0, pose.skeleton->bones[b].radius, detail?16:8, 1);
-      glRotated(180,1,0,0);
-      glTranslated(0, 0, pose.skeleton->bones[b].length);
-      //gluDisk(quad, 0, pose.skeleton->bones[b].radius, detail?16:8, 1);
-      glTranslated(-pose.skeleton->bones[b].radius, 0, -pose.skeleton->bones[b].length);
+      if(above && !(c < above[n])) minimum = false;
+      if(below && !(c <= below[n])) minimum = false;
     }
+    if(!minimum) continue;
+
+    DistanceMap::Transition transition;
+    transition.from_frame = from_frame;
+    transition.to_frame = j;
+    transition.cost = c;
+    candidates.push_back(transition);
+  }
+}
+
+bool cheaper(const DistanceMap::Transition &a, const DistanceMap::Transition &b)
+{
+  if(a.cost != b.cost) return a.cost < b.cost;
+  if(a.from_frame != b.from_frame) return a.from_frame < b.from_frame;
+  return a.to_frame < b.to_frame;
+}
+
+/* A cache file is this header, then the from and to motion filenames (each
+ * padded out to a multiple of 4 bytes), band_begin and band_end, the
+ * distances, and the shortest path as from, to pairs.  Everything in it is
+ * 4 bytes wide, so a mapped file can be read in place. */
+struct CacheHeader
+{
+  char magic[4];
+  unsigned int version;
+  unsigned int signature;
+  unsigned int from_frames;
+  unsigned int to_frames;
+  unsigned int n_interp_frames;
+  unsigned int method;
+  unsigned int window_begin;
+  unsigned int rows;
+  unsigned int n_cells;
+  unsigned int path_length;
+  unsigned int from_name_length;
+  unsigned int to_name_length;
+};
+
+const char CacheMagic[4] = {'D', 'M', 'A', 'P'};
+const unsigned int CacheVersion = 2;
+
+unsigned int padded(unsigned int bytes)
+{
+  return (bytes + 3) & ~3u;
+}
+
+/* FNV-1a; only used to give each pair of motions its own file name, the
+ * names themselves are checked when the file is loaded. */
+unsigned int nameHash(const string &name)
+{
+  unsigned int hash = 2166136261u;
+  for(unsigned int i = 0; i < name.size(); ++i)
+  {
+    hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* The two motions' digests mixed together; a cache file is only good for
+ * the motion data it was worked out from, whatever else is in the
+ * library. */
+unsigned int pairSignature(const Motion *from, const Motion *to)
+{
+  unsigned long long mixed = from->digest * 0x9E3779B97F4A7C15ULL ^ to->digest;
+  mixed ^= mixed >> 29;
+  return (unsigned int) (mixed ^ (mixed >> 32));
+}
+
+/* Returns the next 'size' bytes of a file view and moves past them, or NULL
+ * if the file is too short. */
+const char *take(const char *&at, const char *end, size_t size)
+{
+  if(at == NULL || (size_t) (end - at) < size) return at = NULL;
+  const char *taken = at;
+  at += size;
+  return taken;
+}
+
+void writePadded(ostream &out, const string &name)
+{
+  static const char zeros[4] = {0, 0, 0, 0};
+  out.write(name.data(), name.size());
+  out.write(zeros, padded(name.size()) - name.size());
+}
 
-    glPopMatrix();
+}
 
-    glTranslate(pose.skeleton->bones[b].direction * pose.skeleton->bones[b].length);
-    parent_stack.push_back(b);
-  } // end for
+void DistanceMap::populate(unsigned int threads)
+{
+  // Each tile writes to its own cells with the same kernel, so the result
+  // doesn't depend on the number of threads or the order tiles finish in.
+  // The tiles mustn't unshare the cells themselves at the same time.
+  unshare();
+  PopulateJob job(*this, from->frames(), to->frames());
+  parallel_for(job, job.count(), threads);
+}
+
+void DistanceMap::populateTile(unsigned int from_begin, unsigned int to_begin)
+{
+  unsigned int from_end = min(from_begin + TILE_SIZE, from->frames());
+  unsigned int to_end = min(to_begin + TILE_SIZE, to->frames());
 
-  while (!parent_stack.empty())
+  unshare();
+
+  bool have_tables = !from->joint_positions.empty() && 
+                     !to->joint_positions.empty();
+  assert(!have_tables || from->joint_stride() == to->joint_stride());
+
+  for(unsigned int f = max(from_begin, window_begin); f < from_end; ++f)
   {
-    glPopMatrix();
-    parent_stack.pop_back();
+    // Only the part of the tile inside this row's band is stored
+    unsigned int row = f - window_begin;
+    unsigned int t_begin = max(to_begin, band_begin[row]);
+    unsigned int t_end = min(to_end, band_end[row]);
+    if(t_begin >= t_end) continue;
+
+    if(!have_tables)
+    {
+      // No joint position tables, so there's nothing to vectorize over
+      for(unsigned int t = t_begin; t < t_end; ++t)
+      {
+        getDistance(f, t);
+      }
+      continue;
+    }
+
+    // Rows are stored one from frame after another, so the to frames of the
+    // tile are compared against this from frame and written out in a line.
+    // Tiles are small enough that the joint positions stay in cache.
+    squared_distances(to->get_joint_positions(t_begin), t_end - t_begin,
+                      from->get_joint_positions(f), 1,
+                      from->joint_stride(), findCell(f, t_begin), 1);
   }
+}
+
+void DistanceMap::getJointPositions(Pose const &pose, 
+                                    vector<Vector3f> &positions) const
+{
 
+  /* This used to push and pop the OpenGL modelview stack and read back
+   * GL_MODELVIEW_MATRIX for every bone, which needed a live GL context and
+   * stalled on every readback.  Character::WorldBones from pose_utils.hpp
+   * gives the same joint positions (the base of each bone) on the CPU.
+   *
+   * Root position and orientation are ignored, as they were in the OpenGL
+   * version, so that only the shape of the two poses is compared. */
+
+  Pose local_pose = pose;
+  local_pose.root_position = make_vector(0.0f, 0.0f, 0.0f);
+  local_pose.root_orientation.clear();
+
+  WorldBones world_bones;
+  get_world_bones(local_pose, world_bones);
+
+  positions.insert(positions.end(), world_bones.bases.begin(),
+                   world_bones.bases.end());
 }
 
-void DistanceMap::calcShortestPath(unsigned int n_interp_frames)
+void DistanceMap::calcShortestPath(unsigned int n_interp_frames,
+                                   PathMethod method)
+{
+  if(method == OptimalPath && calcOptimalPath(n_interp_frames)) return;
+
+  calcGreedyPath(n_interp_frames);
+}
+
+void DistanceMap::calcGreedyPath(unsigned int n_interp_frames)
 {
   shortest_path.clear();
 
-  // The Kristine Slot paper suggests a slope limit of 3 frames
-  static const unsigned int slope_limit = 3;
+  static const unsigned int slope_limit = SLOPE_LIMIT;
 
   // Start at the zeroth frame of the first (from) animation
   unsigned int from_frame = 0;
@@ -226,12 +510,9 @@ void DistanceMap::calcShortestPath(unsigned int n_interp_frames)
   // Push the first frame pair
   shortest_path.push_back(make_pair(from_frame, to_frame));
 
-  if(n_interp_frames > 0)
+  while(from_frame < windowBegin(n_interp_frames))
   {
-    while(from_frame < from->frames() - 1 - n_interp_frames)
-    {
-      shortest_path.push_back(make_pair(++from_frame, to_frame));
-    }
+    shortest_path.push_back(make_pair(++from_frame, to_frame));
   }
 
   // NB: The path may end before the "to" animation ends, in which case the
@@ -318,6 +599,464 @@ void DistanceMap::calcShortestPath(unsigned int n_interp_frames)
 
 }
 
+bool DistanceMap::calcOptimalPath(unsigned int n_interp_frames)
+{
+  /* Dynamic time warping, as in the Kristine Slot paper: the path from
+   * (windowBegin, 0) to (last from frame, last_col) with the smallest total
+   * distance, never taking more than SLOPE_LIMIT horizontal or vertical
+   * steps in a row.  To follow the slope limit, each cell has N_STATES
+   * costs: the cheapest way to arrive diagonally, or by the k'th horizontal
+   * step in a row, or by the k'th vertical step in a row.
+   *
+   * Only two rows of costs are kept.  To get the path back we remember,
+   * for each cell, which state the best diagonal, first horizontal and
+   * first vertical step came from (the rest just continue a run).  Those
+   * are single bytes, and only for cells the slope limit lets a path go
+   * through. */
+  static const unsigned int S = SLOPE_LIMIT;
+  static const unsigned int DIAG = 0;
+  static const unsigned int HORIZ = 1;         // HORIZ + k - 1: k'th in a row
+  static const unsigned int VERT = 1 + S;      // VERT + k - 1: k'th in a row
+  const float infinity = numeric_limits<float>::infinity();
+
+  const unsigned int first = windowBegin(n_interp_frames);
+  const unsigned int rows = from->frames() - first;
+  // Blend the from window into the same number of to frames, if there are
+  // that many.
+  const unsigned int last_col = min(to->frames(), rows) - 1;
+  const unsigned int cols = last_col + 1;
+
+  if(rows > (S + 1) * cols) return false; // Can't get there with this slope
+
+  // Columns each row can reach from the start and still reach the end from
+  vector<unsigned int> lo(rows), hi(rows), bp_offset(rows);
+  unsigned int bp_cells = 0;
+  for(unsigned int r = 0; r < rows; ++r)
+  {
+    unsigned int rows_left = rows - 1 - r;
+    lo[r] = r / (S + 1);
+    if(last_col > (S + 1) * rows_left + S)
+      lo[r] = max(lo[r], last_col - (S + 1) * rows_left - S);
+    hi[r] = min(cols, (S + 1) * (r + 1));
+    hi[r] = min(hi[r], last_col - rows_left / (S + 1) + 1);
+    if(lo[r] >= hi[r]) return false;
+    bp_offset[r] = bp_cells;
+    bp_cells += hi[r] - lo[r];
+  }
+
+  // Make sure the distances the search needs have been worked out
+  for(unsigned int f = first; f < from->frames(); f += TILE_SIZE)
+  {
+    unsigned int r_end = min(rows, f - first + TILE_SIZE);
+    for(unsigned int t = lo[f - first]; t < hi[r_end - 1]; t += TILE_SIZE)
+    {
+      populateTile(f, t);
+    }
+  }
+
+  vector<unsigned char> from_diag(bp_cells);
+  vector<unsigned char> from_horiz(bp_cells);
+  vector<unsigned char> from_vert(bp_cells);
+
+  // One plane of cols costs per state, for the previous and current rows
+  vector<float> prev_costs(N_STATES * cols, infinity);
+  vector<float> cur_costs(N_STATES * cols, infinity);
+  vector<float> cell(cols, infinity);
+  float *prev = &(prev_costs[0]);
+  float *cur = &(cur_costs[0]);
+
+  for(unsigned int r = 0; r < rows; ++r)
+  {
+    // Clear out the costs cur still has from two rows ago
+    for(unsigned int s = 0; r >= 2 && s < N_STATES; ++s)
+    {
+      fill(cur + s * cols + lo[r - 2], cur + s * cols + hi[r - 2], infinity);
+    }
+
+    for(unsigned int t = lo[r]; t < hi[r]; ++t)
+    {
+      float *c = findCell(first + r, t);
+      cell[t] = c ? *c : infinity;
+    }
+
+    unsigned char *bd = &(from_diag[bp_offset[r]]) - lo[r];
+    unsigned char *bh = &(from_horiz[bp_offset[r]]) - lo[r];
+    unsigned char *bv = &(from_vert[bp_offset[r]]) - lo[r];
+
+    if(r == 0)
+    {
+      cur[DIAG * cols] = cell[0];
+    }
+    else
+    {
+      // Steps from the previous row don't depend on each other, so these
+      // loops run straight along the row and vectorize.
+      unsigned int t_lo = max(lo[r], 1u);
+      if(lo[r] == 0) bd[0] = DIAG;
+      for(unsigned int t = t_lo; t < hi[r]; ++t)
+      {
+        cur[DIAG * cols + t] = prev[t - 1];
+        bd[t] = DIAG;
+      }
+      for(unsigned int s = 1; s < N_STATES; ++s)
+      {
+        const float *p = prev + s * cols - 1;
+        for(unsigned int t = t_lo; t < hi[r]; ++t)
+        {
+          bool better = p[t] < cur[DIAG * cols + t];
+          cur[DIAG * cols + t] = better ? p[t] : cur[DIAG * cols + t];
+          bd[t] = better ? s : bd[t];
+        }
+      }
+
+      // First horizontal step: after a diagonal or vertical one
+      for(unsigned int t = lo[r]; t < hi[r]; ++t)
+      {
+        cur[HORIZ * cols + t] = prev[DIAG * cols + t];
+        bh[t] = DIAG;
+      }
+      for(unsigned int s = VERT; s < VERT + S; ++s)
+      {
+        const float *p = prev + s * cols;
+        for(unsigned int t = lo[r]; t < hi[r]; ++t)
+        {
+          bool better = p[t] < cur[HORIZ * cols + t];
+          cur[HORIZ * cols + t] = better ? p[t] : cur[HORIZ * cols + t];
+          bh[t] = better ? s : bh[t];
+        }
+      }
+      // Later horizontal steps continue a run
+      for(unsigned int k = 1; k < S; ++k)
+      {
+        for(unsigned int t = lo[r]; t < hi[r]; ++t)
+        {
+          cur[(HORIZ + k) * cols + t] = prev[(HORIZ + k - 1) * cols + t];
+        }
+      }
+
+      for(unsigned int s = DIAG; s < VERT; ++s)
+      {
+        for(unsigned int t = lo[r]; t < hi[r]; ++t)
+        {
+          cur[s * cols + t] += cell[t];
+        }
+      }
+    }
+
+    // Vertical steps depend on the cell before them in this row, so they
+    // have to go one at a time.
+    for(unsigned int t = max(lo[r], 1u); t < hi[r]; ++t)
+    {
+      float best = cur[DIAG * cols + t - 1];
+      unsigned char best_state = DIAG;
+      for(unsigned int s = HORIZ; s < HORIZ + S; ++s)
+      {
+        if(cur[s * cols + t - 1] < best)
+        {
+          best = cur[s * cols + t - 1];
+          best_state = s;
+        }
+      }
+      cur[VERT * cols + t] = best + cell[t];
+      bv[t] = best_state;
+      for(unsigned int k = 1; k < S; ++k)
+      {
+        cur[(VERT + k) * cols + t] = cur[(VERT + k - 1) * cols + t - 1] + cell[t];
+      }
+    }
+
+    std::swap(prev, cur);
+  }
+
+  // prev is now the last row; find the cheapest way into the end cell
+  unsigned int state = DIAG;
+  for(unsigned int s = 1; s < N_STATES; ++s)
+  {
+    if(prev[s * cols + last_col] < prev[state * cols + last_col]) state = s;
+  }
+  if(prev[state * cols + last_col] == infinity) return false;
+
+  // Walk back to the start
+  vector<pair<unsigned int, unsigned int> > warp;
+  unsigned int r = rows - 1;
+  unsigned int t = last_col;
+  warp.push_back(make_pair(first + r, t));
+  while(r > 0 || t > 0)
+  {
+    unsigned int bp = bp_offset[r] + (t - lo[r]);
+    if(state == DIAG)
+    {
+      state = from_diag[bp];
+      --r;
+      --t;
+    }
+    else if(state < VERT)
+    {
+      state = (state == HORIZ) ? from_horiz[bp] : state - 1;
+      --r;
+    }
+    else
+    {
+      state = (state == VERT) ? from_vert[bp] : state - 1;
+      --t;
+    }
+    warp.push_back(make_pair(first + r, t));
+  }
+
+  // Play the from animation up to the window, then the warped path, then
+  // whatever is left of the to animation.
+  shortest_path.clear();
+  for(unsigned int f = 0; f < first; ++f)
+  {
+    shortest_path.push_back(make_pair(f, 0u));
+  }
+  shortest_path.insert(shortest_path.end(), warp.rbegin(), warp.rend());
+  for(unsigned int to_frame = last_col + 1; to_frame < to->frames(); ++to_frame)
+  {
+    shortest_path.push_back(make_pair(from->frames() - 1, to_frame));
+  }
+
+  return true;
+}
+
+void DistanceMap::findTransitions(unsigned int window, unsigned int k,
+                                  vector<Transition> &transitions,
+                                  unsigned int threads)
+{
+  transitions.clear();
+
+  const unsigned int n_from = from->frames();
+  const unsigned int n_to = to->frames();
+  if(window == 0 || window > n_from || window > n_to || k == 0) return;
+
+  populate(threads);
+
+  /* The cost of the window starting at (i, j) is the sum of the distances
+   * from (i, j) to (i + window - 1, j + window - 1).  Keeping running sums
+   * down the diagonals, sums[r][c] = distance(r - 1, c - 1) +
+   * sums[r - 1][c - 1] (zero on the first row and column), every window
+   * cost is just sums[i + window][j + window] - sums[i][j].  Sums are only
+   * needed 'window' rows back, so they go round in a ring of window + 1
+   * rows, and window costs in a ring of 3 so each row can be checked
+   * against its neighbours once the next one is done. */
+  const unsigned int cols = n_to - window + 1;
+  vector<double> sums((window + 1) * (n_to + 1), 0.0);
+  vector<float> costs(3 * cols);
+  vector<float> row_buffer(n_to);
+  vector<Transition> candidates;
+
+  for(unsigned int r = 0; r < n_from; ++r)
+  {
+    // A whole row of distances, straight from the map if it's all stored
+    const float *dist;
+    unsigned int band_row = r - window_begin;
+    if(r >= window_begin && band_begin[band_row] == 0 &&
+       band_end[band_row] == n_to)
+    {
+      dist = findCell(r, 0);
+    }
+    else
+    {
+      for(unsigned int t = 0; t < n_to; ++t)
+      {
+        row_buffer[t] = *getDistance(r, t);
+      }
+      dist = &(row_buffer[0]);
+    }
+
+    const double *prev = &(sums[(r % (window + 1)) * (n_to + 1)]);
+    double *cur = &(sums[((r + 1) % (window + 1)) * (n_to + 1)]);
+    for(unsigned int t = 0; t < n_to; ++t)
+    {
+      cur[t + 1] = dist[t] + prev[t];
+    }
+
+    if(r + 1 < window) continue;
+
+    // Window costs for the windows starting on from frame i
+    unsigned int i = r + 1 - window;
+    const double *start = &(sums[(i % (window + 1)) * (n_to + 1)]);
+    float *cost_row = &(costs[(i % 3) * cols]);
+    for(unsigned int j = 0; j < cols; ++j)
+    {
+      cost_row[j] = cur[j + window] - start[j];
+    }
+
+    // Now the row before has both its neighbours
+    if(i > 0)
+    {
+      addLocalMinima(i > 1 ? &(costs[((i - 2) % 3) * cols]) : NULL,
+                     &(costs[((i - 1) % 3) * cols]), cost_row,
+                     i - 1, cols, candidates);
+    }
+  }
+  unsigned int last = n_from - window;
+  addLocalMinima(last > 0 ? &(costs[((last - 1) % 3) * cols]) : NULL,
+                 &(costs[(last % 3) * cols]), NULL,
+                 last, cols, candidates);
+
+  // Jumping to about where we already are isn't much of a transition
+  if(from == to)
+  {
+    for(unsigned int c = 0; c < candidates.size(); ++c)
+    {
+      unsigned int f = candidates[c].from_frame;
+      unsigned int t = candidates[c].to_frame;
+      if((f > t ? f - t : t - f) >= window)
+      {
+        transitions.push_back(candidates[c]);
+      }
+    }
+    candidates.swap(transitions);
+    transitions.clear();
+  }
+
+  k = min(k, (unsigned int) candidates.size());
+  partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(),
+               cheaper);
+  transitions.assign(candidates.begin(), candidates.begin() + k);
+}
+
+string DistanceMap::cacheFilename() const
+{
+  ostringstream name;
+  name << hex << setfill('0')
+       << setw(8) << nameHash(from->filename) << "-"
+       << setw(8) << nameHash(to->filename) << ".dmap";
+  return cache_file(name.str());
+}
+
+bool DistanceMap::loadCache(unsigned int n_interp_frames, PathMethod method)
+{
+  if(cache_path.empty()) return false;
+
+  FileView file(cacheFilename());
+  const char *at = file.data();
+  const char *end = at + file.size();
+
+  const CacheHeader *header = 
+    (const CacheHeader *) take(at, end, sizeof(CacheHeader));
+  if(header == NULL ||
+     memcmp(header->magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+     header->version != CacheVersion ||
+     header->signature != pairSignature(from, to) ||
+     header->from_frames != from->frames() ||
+     header->to_frames != to->frames() ||
+     header->n_interp_frames != n_interp_frames ||
+     header->method != (unsigned int) method ||
+     header->window_begin != window_begin ||
+     header->rows != band_begin.size() ||
+     header->n_cells != n_cells)
+  {
+    return false;
+  }
+
+  // The file name is only a hash, so make sure it's the right pair
+  const char *from_name = take(at, end, padded(header->from_name_length));
+  const char *to_name = take(at, end, padded(header->to_name_length));
+  if(at == NULL ||
+     from->filename != string(from_name, header->from_name_length) ||
+     to->filename != string(to_name, header->to_name_length))
+  {
+    return false;
+  }
+
+  size_t band_size = header->rows * sizeof(unsigned int);
+  const char *file_band_begin = take(at, end, band_size);
+  const char *file_band_end = take(at, end, band_size);
+  const char *cells = take(at, end, n_cells * sizeof(float));
+  const unsigned int *path = (const unsigned int *)
+    take(at, end, header->path_length * 2 * sizeof(unsigned int));
+  if(at == NULL ||
+     memcmp(file_band_begin, &(band_begin[0]), band_size) != 0 ||
+     memcmp(file_band_end, &(band_end[0]), band_size) != 0)
+  {
+    return false;
+  }
+
+  unshare();
+  memcpy(distances, cells, n_cells * sizeof(float));
+  shortest_path.resize(header->path_length);
+  for(unsigned int i = 0; i < shortest_path.size(); ++i)
+  {
+    shortest_path[i] = make_pair(path[2 * i], path[2 * i + 1]);
+  }
+
+  return true;
+}
+
+bool DistanceMap::saveCache(unsigned int n_interp_frames, 
+                            PathMethod method) const
+{
+  if(cache_path.empty()) return false;
+
+  CacheHeader header;
+  memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+  header.version = CacheVersion;
+  header.signature = pairSignature(from, to);
+  header.from_frames = from->frames();
+  header.to_frames = to->frames();
+  header.n_interp_frames = n_interp_frames;
+  header.method = method;
+  header.window_begin = window_begin;
+  header.rows = band_begin.size();
+  header.n_cells = n_cells;
+  header.path_length = shortest_path.size();
+  header.from_name_length = from->filename.size();
+  header.to_name_length = to->filename.size();
+
+  vector<unsigned int> path;
+  for(unsigned int i = 0; i < shortest_path.size(); ++i)
+  {
+    path.push_back(shortest_path[i].first);
+    path.push_back(shortest_path[i].second);
+  }
+
+  // Write to the side and rename over the old file when done, so nobody
+  // loads a half-written one.  Each writer gets a file of its own to write
+  // to, so two saving the same pair at once can't mix their files up.
+  string filename = cacheFilename();
+  string temp_filename = claimTempFile(filename);
+  if(temp_filename.empty()) return false;
+  {
+    ofstream out(temp_filename.c_str(), ios::out | ios::binary);
+    if(!out)
+    {
+      remove(temp_filename.c_str());
+      return false;
+    }
+    out.write((const char *) &header, sizeof(header));
+    writePadded(out, from->filename);
+    writePadded(out, to->filename);
+    out.write((const char *) &(band_begin[0]), 
+              band_begin.size() * sizeof(unsigned int));
+    out.write((const char *) &(band_end[0]), 
+              band_end.size() * sizeof(unsigned int));
+    out.write((const char *) distances, n_cells * sizeof(float));
+    if(!path.empty())
+    {
+      out.write((const char *) &(path[0]), path.size() * sizeof(unsigned int));
+    }
+    if(!out)
+    {
+      out.close();
+      remove(temp_filename.c_str());
+      return false;
+    }
+  }
+
+#ifdef WINDOWS
+  // rename won't replace an existing file here
+  remove(filename.c_str());
+#endif
+  if(rename(temp_filename.c_str(), filename.c_str()) != 0)
+  {
+    remove(temp_filename.c_str());
+    return false;
+  }
+  return true;
+}
+
 const vector<pair<unsigned int, unsigned int> >& DistanceMap::getShortestPath() const
 {
   return shortest_path;
@@ -7,6 +7,7 @@
 #include <vector>
 #include <utility>
 #include <iostream>
+#include <string>
 
 namespace Library
 {
@@ -17,28 +18,114 @@ namespace Library
 class DistanceMap
 {
 public:
-  /* Initializes a lerp blender from two motions to be blended */
+  /* Initializes a distance map between two motions to be blended.  Every
+   * cell of the map is stored. */
   DistanceMap(const Motion *f, const Motion *t);
+
+  /* Initializes a banded distance map, which only stores the cells that
+   * calcShortestPath(n_interp_frames) can visit: the last n_interp_frames
+   * of the from motion, and within those only the corridor the slope limit
+   * allows.  getDistance still works for any cell, but cells outside the
+   * band aren't kept. */
+  DistanceMap(const Motion *f, const Motion *t, unsigned int n_interp_frames);
+  /* Copies share the stored cells rather than copying them, so copying a
+   * map is cheap.  A copy only takes its own cells when it's about to
+   * change them (filling in a distance, populate, loadCache).  The sharing
+   * isn't locked: copies may go to other threads, but two copies mustn't
+   * be used from different threads at once. */
   DistanceMap(const DistanceMap &other);
   DistanceMap& operator= (const DistanceMap &other);
 
   ~DistanceMap();
 
+  /* Exchanges two maps without copying anything */
+  void swap(DistanceMap &other);
+
   /* DO NOT index into the distance map manually or a mistake will inevitably
    * be made at some point.  ALWAYS use this function to get the correct
-   * address. */
+   * address.  For cells outside the band of a banded map, the address is
+   * only good until the next call.  Don't write through it: the cell may
+   * be shared with copies of this map. */
   float* getDistance(unsigned int from_frame, unsigned int to_frame);
 
+  /* Number of cells actually stored (from frames * to frames unless the map
+   * is banded). */
+  unsigned int storedCells() const;
+
+  /* Normally distances are computed one at a time as getDistance asks for
+   * them.  This fills in the whole map at once, tile by tile, using the
+   * vectorized kernel in DistanceKernel.hpp - much faster when most of the
+   * map is going to be needed anyway.  Tiles are shared out between
+   * 'threads' threads (0 means one per processor); the result is the same
+   * whatever the thread count. */
+  void populate(unsigned int threads = 1);
+
+  /* Fills in the tile of the map starting at the given frames (see
+   * populate).  Different tiles may be filled from different threads at
+   * once, as long as the cells aren't shared with a copy (populate makes
+   * sure of that before it starts). */
+  void populateTile(unsigned int from_begin, unsigned int to_begin);
+
   /* Finds joint positions in the world coordinate system and puts them in the
    * positions vector. They will be in the same order as the bones are defined
-   * in the motion. */
+   * in the motion.  Root position and orientation are ignored.  This is plain
+   * forward kinematics on the CPU, so it doesn't need a GL context. */
   void getJointPositions(Character::Pose const &pose, 
                          std::vector<Vector3f> &positions) const;
 
+  /* Ways for calcShortestPath to find its path */
+  enum PathMethod
+  {
+    /* Step to whichever neighbour is closest.  Only looks at the distances
+     * next to the path, but may miss a better path. */
+    GreedyPath,
+    /* Dynamic time warping: the slope-limited path through the blend window
+     * with the smallest total distance.  Looks at every distance in the
+     * window. */
+    OptimalPath
+  };
+
   /* Calculate the "shortest path" between the two animations - the combination
    * of frames which approximates the minimum distance between blended frame
-   * pairs.  This should maybe be rolled into populate... */
-  void calcShortestPath(unsigned int n_interp_frames);
+   * pairs.  This should maybe be rolled into populate...
+   * OptimalPath blends the last n_interp_frames of the from animation into
+   * the first n_interp_frames of the to animation; if the to animation is
+   * too short for that with the slope limit, it falls back to GreedyPath. */
+  void calcShortestPath(unsigned int n_interp_frames,
+                        PathMethod method = GreedyPath);
+
+  /* A place to jump from one animation to the other: blend from frames
+   * from_frame onwards into to frames to_frame onwards.  cost is the sum of
+   * the distances along the diagonal of the blend window. */
+  struct Transition
+  {
+    unsigned int from_frame;
+    unsigned int to_frame;
+    float cost;
+  };
+
+  /* Finds the (up to) k cheapest transitions with a window of 'window'
+   * frames, anywhere in the map, cheapest first.  Only transitions that are
+   * cheaper than the ones next to them are counted, so the results aren't
+   * all the same spot shifted by a frame.  When both motions are the same,
+   * transitions less than a window away from where the motion already is
+   * are skipped.  Calls populate(threads) first, so this is meant for
+   * unbanded maps; a banded one works but computes its cells outside the
+   * band one at a time. */
+  void findTransitions(unsigned int window, unsigned int k,
+                       std::vector<Transition> &transitions,
+                       unsigned int threads = 1);
+
+  /* The cells worked out so far and the shortest path can be kept between
+   * runs, in a file under Library::cache_path for each pair of motions.
+   * The file remembers both motions' digests, the band, and what
+   * calcShortestPath was given; loadCache only succeeds if all of those
+   * match, so when either motion's data changes its old files are ignored
+   * (and replaced by the next saveCache), while the rest stay good.  The
+   * file is laid out so it can be mapped into memory and copied straight
+   * out. */
+  bool loadCache(unsigned int n_interp_frames, PathMethod method);
+  bool saveCache(unsigned int n_interp_frames, PathMethod method) const;
 
   /* Accessor for shortest_path member.  You must call calcShortestPath()
    * before calling this or the vector will be empty. */
@@ -47,10 +134,56 @@ public:
   friend ostream& operator<<(ostream &out, DistanceMap &map);
 
 private:
+  /* Sets up band_offset and allocates distances for the band */
+  void allocate();
+
+  /* First from frame calcShortestPath(n_interp_frames) looks at */
+  unsigned int windowBegin(unsigned int n_interp_frames) const;
+
+  /* The two ways of doing calcShortestPath.  calcOptimalPath returns false
+   * (and leaves shortest_path alone) if there is no slope-limited path. */
+  void calcGreedyPath(unsigned int n_interp_frames);
+  bool calcOptimalPath(unsigned int n_interp_frames);
+
+  /* Where loadCache and saveCache keep this pair of motions */
+  std::string cacheFilename() const;
+
+  /* Drop this map's hold on its cells, deleting them if nobody else has
+   * them */
+  void release();
+
+  /* Make sure nobody else has this map's cells, copying them if needed */
+  void unshare();
+
+  /* Address of a stored cell, or NULL if it's outside the band */
+  float* findCell(unsigned int from_frame, unsigned int to_frame);
+
+  /* The stored cells, and how many maps have them */
+  struct SharedCells
+  {
+    unsigned int refcount;
+    float *cells;
+  };
+  SharedCells *shared;
+
+  /* Same as shared->cells */
   float *distances;
 
   std::vector<std::pair<unsigned int, unsigned int> > shortest_path;
 
+  /* The cells that are stored: from frames starting at window_begin, and
+   * for each of those (row = from frame - window_begin) the to frames
+   * from band_begin[row] up to but not including band_end[row].  Each row
+   * starts at band_offset[row] in distances. */
+  unsigned int window_begin;
+  std::vector<unsigned int> band_begin;
+  std::vector<unsigned int> band_end;
+  std::vector<unsigned int> band_offset;
+  unsigned int n_cells;
+
+  /* Where getDistance puts distances it doesn't store */
+  float outside_band;
+
   /* These should really be const, but I can't make them const and still have
    * distances be heap-allocated without ignoring the rule of three... I am
    * fairly certain I am doing something wrong here in terms of idiomatic C++
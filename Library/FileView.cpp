@@ -0,0 +1,101 @@
+#include "Library/FileView.hpp"
+
+#include <sstream>
+#include <cerrno>
+
+#ifdef WINDOWS
+#include <fstream>
+#include <io.h>
+#include <process.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+namespace Library
+{
+
+FileView::FileView(const std::string &filename)
+: bytes(NULL),
+  length(0),
+  is_open(false)
+{
+#ifdef WINDOWS
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  if(!in) return;
+  is_open = true;
+  in.seekg(0, std::ios::end);
+  size_t file_length = (size_t) in.tellg();
+  if(file_length == 0) return;
+  buffer.resize(file_length);
+  in.seekg(0, std::ios::beg);
+  in.read(&(buffer[0]), file_length);
+  if(!in) return;
+  bytes = &(buffer[0]);
+  length = file_length;
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0) return;
+  struct stat info;
+  if(fstat(fd, &info) == 0)
+  {
+    is_open = true;
+    if(info.st_size > 0)
+    {
+      void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(mapped != MAP_FAILED)
+      {
+        bytes = (const char *) mapped;
+        length = info.st_size;
+      }
+      else
+      {
+        is_open = false;
+      }
+    }
+  }
+  close(fd);
+#endif
+}
+
+FileView::~FileView()
+{
+#ifndef WINDOWS
+  if(bytes) munmap((void *) bytes, length);
+#endif
+}
+
+std::string claimTempFile(const std::string &filename)
+{
+  for(unsigned int attempt = 0; attempt < 100; ++attempt)
+  {
+    std::ostringstream name;
+#ifdef WINDOWS
+    name << filename << '.' << _getpid() << '.' << attempt << ".tmp";
+    int fd = _open(name.str().c_str(), _O_WRONLY | _O_CREAT | _O_EXCL,
+                   _S_IREAD | _S_IWRITE);
+    if(fd >= 0)
+    {
+      _close(fd);
+      return name.str();
+    }
+#else
+    name << filename << '.' << getpid() << '.' << attempt << ".tmp";
+    int fd = open(name.str().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(fd >= 0)
+    {
+      close(fd);
+      return name.str();
+    }
+#endif
+    if(errno != EEXIST) return std::string();
+  }
+  return std::string();
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef FILEVIEW_HPP
+#define FILEVIEW_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace Library
+{
+
+/* The whole of a file, read-only: mapped into memory where we know how,
+ * otherwise read in.  data() is NULL if the file couldn't be opened or is
+ * empty; opened() tells the two apart. */
+class FileView
+{
+public:
+  FileView(const std::string &filename);
+  ~FileView();
+
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+  bool opened() const { return is_open; }
+
+private:
+  FileView(const FileView &);
+  FileView& operator= (const FileView &);
+
+  const char *bytes;
+  size_t length;
+  bool is_open;
+#ifdef WINDOWS
+  std::vector<char> buffer;
+#endif
+};
+
+/* Makes a new, empty file beside 'filename' that no other writer (in this
+ * process or another) has, and returns its name, or "" if it can't.  For
+ * writing a file under a temporary name and renaming it into place. */
+std::string claimTempFile(const std::string &filename);
+
+}
+
+#endif
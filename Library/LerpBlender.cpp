@@ -4,6 +4,7 @@
 #include <Vector/Quat.hpp>
 
 #include <cmath>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
@@ -16,28 +17,46 @@ using std::vector;
 namespace Library
 {
 
-LerpBlender::LerpBlender(const Motion *f, const Motion *t)
+namespace
+{
+
+/* For now we're naively interpolating the last quarter of the first animation
+ * with the first quarter of the last animation.
+ * Since the animations aren't the same length, in practice we'll interpolate
+ * n frames where n is one quarter of the number of frames in the shorter
+ * animation.  This is probably a bad way to go about things, for a number of
+ * reasons which I'm not going to enumerate at the moment.
+ * Also: ternary ifs are bad. Do as I say, not as I do. */
+unsigned int interpFrames(const Motion *f, const Motion *t)
+{
+  return f->frames() < t->frames() ? 
+         (f->frames() / INTERP_DIVISOR) : (t->frames() / INTERP_DIVISOR);
+}
+
+}
+
+LerpBlender::LerpBlender(const Motion *f, const Motion *t,
+                         DistanceMap::PathMethod method)
 : from(f),
   to(t),
-  distance_map(f, t),
+  // Only the cells the path search can reach are stored
+  distance_map(f, t, interpFrames(f, t)),
   last_frame(0),
-  cur_frame(0)
+  cur_frame(0),
+  path_method(method)
 { 
   n_from_frames = from->frames();
   n_to_frames = to->frames();
 
-  /* For now we're naively interpolating the last quarter of the first animation
-   * with the first quarter of the last animation.
-   * Since the animations aren't the same length, in practice we'll interpolate
-   * n frames where n is one quarter of the number of frames in the shorter
-   * animation.  This is probably a bad way to go about things, for a number of
-   * reasons which I'm not going to enumerate at the moment.
-   * Also: ternary ifs are bad. Do as I say, not as I do. */
-  n_interp_frames = n_from_frames < n_to_frames ? 
-                    (n_from_frames / INTERP_DIVISOR) : (n_to_frames / INTERP_DIVISOR);
+  n_interp_frames = interpFrames(from, to);
 
   // TODO: cout message should go somewhere else
-  distance_map.calcShortestPath(n_interp_frames);
+  // Nothing to work out if this pair was blended on an earlier run
+  if(!distance_map.loadCache(n_interp_frames, path_method))
+  {
+    distance_map.calcShortestPath(n_interp_frames, path_method);
+    distance_map.saveCache(n_interp_frames, path_method);
+  }
 
   global_state.clear();
   velocity_control.clear();
@@ -54,7 +73,8 @@ LerpBlender::LerpBlender(const LerpBlender &other)
   cur_frame(other.cur_frame),
   n_from_frames(other.n_from_frames),
   n_to_frames(other.n_to_frames),
-  n_interp_frames(other.n_interp_frames)
+  n_interp_frames(other.n_interp_frames),
+  path_method(other.path_method)
 {
 }
 
@@ -70,17 +90,42 @@ LerpBlender& LerpBlender::operator= (const LerpBlender &other)
   n_from_frames = other.n_from_frames;
   n_to_frames = other.n_to_frames;
   n_interp_frames = other.n_interp_frames;
+  path_method = other.path_method;
   global_state = other.global_state;
   velocity_control = other.velocity_control;
 
   return *this;
 }
 
+void LerpBlender::swap(LerpBlender &other)
+{
+  std::swap(from, other.from);
+  std::swap(to, other.to);
+  std::swap(global_state, other.global_state);
+  std::swap(velocity_control, other.velocity_control);
+  distance_map.swap(other.distance_map);
+  std::swap(last_frame, other.last_frame);
+  std::swap(cur_frame, other.cur_frame);
+  std::swap(n_from_frames, other.n_from_frames);
+  std::swap(n_to_frames, other.n_to_frames);
+  std::swap(n_interp_frames, other.n_interp_frames);
+  std::swap(path_method, other.path_method);
+  poses.swap(other.poses);
+}
+
 LerpBlender LerpBlender::blendFromBlend(const LerpBlender &old, const Motion *m)
 {
 
   // Create a new LerpBlender from the old "to" motion, and the new motion, m
-  LerpBlender blender(old.to, m);
+  LerpBlender blender(old.to, m, old.path_method);
+  blender.followOn(old);
+  return blender;
+}
+
+void LerpBlender::followOn(const LerpBlender &old)
+{
+  LerpBlender &blender = *this;
+  assert(blender.from == old.to);
 
   /* Here's the complicated part... frames are specified by locations in the
    * distance map.  To determine which frame we should be on, we need to
@@ -121,8 +166,6 @@ LerpBlender LerpBlender::blendFromBlend(const LerpBlender &old, const Motion *m)
   // Copy global state from the old blender so the motion stays in the right
   // position
   blender.global_state = old.global_state;
-  
-  return blender;
 }
 
 void LerpBlender::changeFrame(int delta)
@@ -152,18 +195,13 @@ void LerpBlender::changeFrame(int delta)
 void LerpBlender::getPose(Pose &output)
 {
 
-  /* Create and initialize (not sure why these are separate steps, very
-   * non-idiomatic; herpderp I'm pedantic) poses for the from and to
-   * to motions */
-  Pose from_pose;
-  Pose to_pose;
-  from_pose.clear();
-  to_pose.clear();
-
+  /* Poses for the from and to motions.  These come from the pose cache, so
+   * each frame is only decoded once (the current pair is the last pair next
+   * time round) and nothing is allocated once playback gets going. */
   const pair<unsigned int, unsigned int> frame_pair = 
     distance_map.getShortestPath()[cur_frame];
-  from->get_pose(frame_pair.first, from_pose);
-  to->get_pose(frame_pair.second, to_pose);
+  const Pose &from_pose = poses.get(from, frame_pair.first);
+  const Pose &to_pose = poses.get(to, frame_pair.second);
 
   float interp_value = expf((float) frame_pair.second / n_interp_frames) - 1;
   if(interp_value > 1.0f)
@@ -174,25 +212,28 @@ void LerpBlender::getPose(Pose &output)
   float interp_conjugate = 1.0f - interp_value;
 
   /* Loop through all bones and interpolate their orientation quaternions
-   * Note that we asserted above that the two animations have the same number
-   * of bones */
+   * straight into the output (which keeps its memory from the last call).
+   * Note that we asserted above that the two animations have the same
+   * number of bones */
+  output.bone_orientations.resize(from_pose.bone_orientations.size());
   for(unsigned int i = 0; i < from_pose.bone_orientations.size(); ++i)
   {
-    from_pose.bone_orientations[i] = slerp(from_pose.bone_orientations[i],
-                                           to_pose.bone_orientations[i],
-                                           interp_value);
+    output.bone_orientations[i] = slerp(from_pose.bone_orientations[i],
+                                        to_pose.bone_orientations[i],
+                                        interp_value);
   }
 
   // Interpolate the root position and orientation
-  from_pose.root_orientation = slerp(from_pose.root_orientation,
-                                     to_pose.root_orientation,
-                                     interp_value);
+  output.root_orientation = slerp(from_pose.root_orientation,
+                                  to_pose.root_orientation,
+                                  interp_value);
+  output.skeleton = from_pose.skeleton;
 
-  // Assign the output frame to be equal to the interpolated from pose.
+  // The output frame is now the interpolated from pose.
   // We're not done yet, though; using root positions is unreliable,
   // so instead we'll want to use velocities, which we'll calculate below.
   // For now, set the output x and z positions to 0.
-  output = from_pose;
+  output.root_position = from_pose.root_position;
   output.root_position.x = output.root_position.z = 0;
 
   // Get the next frame pair.  If we're at the end of both animations,
@@ -202,13 +243,8 @@ void LerpBlender::getPose(Pose &output)
     distance_map.getShortestPath()[last_frame];
 
   // Determine velocity in each of the animations
-  Pose from_last;
-  from_last.clear();
-  from->get_pose(last_pair.first, from_last);
-
-  Pose to_last;
-  to_last.clear();
-  to->get_pose(last_pair.second, to_last);
+  const Pose &from_last = poses.get(from, last_pair.first);
+  const Pose &to_last = poses.get(to, last_pair.second);
 
   // We interpolate the velocity according to the interpolation value
   // calculated above
@@ -3,6 +3,7 @@
 
 #include <Library/Library.hpp>
 #include <Library/DistanceMap.hpp>
+#include <Library/PoseCache.hpp>
 #include <Character/Character.hpp>
 
 #include <vector>
@@ -16,22 +17,40 @@ namespace Library
 class LerpBlender
 {
 public:
-  /* Initializes a lerp blender from two motions to be blended */
-  LerpBlender(const Motion *f, const Motion *t);
+  /* Initializes a lerp blender from two motions to be blended, choosing
+   * the frames to blend with the given DistanceMap path method */
+  LerpBlender(const Motion *f, const Motion *t,
+              DistanceMap::PathMethod method = DistanceMap::GreedyPath);
+  /* Copying a blender is cheap: the copy shares the distance map's cells
+   * (see DistanceMap). */
   LerpBlender(const LerpBlender &other);
   LerpBlender& operator= (const LerpBlender &other);
 
+  /* Exchanges two blenders without copying anything */
+  void swap(LerpBlender &other);
+
   static LerpBlender blendFromBlend(const LerpBlender &old, const Motion *m);
 
+  /* The part of blendFromBlend after the new blender is built: picks up
+   * where old is in its to motion, which must be this blender's from
+   * motion.  Lets the new blender be built ahead of time (see
+   * BackgroundBlender). */
+  void followOn(const LerpBlender &old);
+
   /* Increment or decrement frame */ 
   void changeFrame(int delta);
 
+  /* Reuse the same output pose from call to call and this doesn't allocate
+   * anything */
   void getPose(Character::Pose &output);
 
   /* Accessors for motions */
   const Motion *getFromMotion() const { return from; }
   const Motion *getToMotion() const { return to; }
 
+  /* How the frames to blend were picked */
+  DistanceMap::PathMethod getPathMethod() const { return path_method; }
+
   /* Get the current frame number */
   unsigned int getFrame() { return cur_frame; }
 
@@ -72,6 +91,13 @@ private:
   // This will be equal to one quarter of the total number of frames in the
   // motion which has fewer frames
   unsigned int n_interp_frames;
+
+  // How the frames to blend were picked; blendFromBlend carries it on
+  DistanceMap::PathMethod path_method;
+
+  // Decoded poses of the frames getPose used last; enough slots for the
+  // current and last frame pairs
+  PoseCache poses;
 };
 
 }
@@ -1,27 +1,35 @@
 #include "Library.hpp"
 
 #include "ReadSkeleton.hpp"
+#include "DistanceKernel.hpp"
+#include "Parallel.hpp"
 
 #include <Character/pose_utils.hpp>
 
 #include <Vector/Misc.hpp>
 
+#include <SDL.h>
+#include <SDL_thread.h>
+
 #include <list>
 #include <fstream>
 #include <vector>
 #include <deque>
+#include <map>
 #include <algorithm>
 
 #ifdef WINDOWS
 //windows-y directory listing.
 #include <io.h>
+#include <direct.h>
 #else
 //linux-specific:
 #include <dirent.h>
 #include <errno.h>
+#endif
 #include <sys/stat.h>
 #include <sys/types.h>
-#endif
+#include <string.h>
 
 namespace Library
 {
@@ -58,26 +66,86 @@ namespace
 {
 list< Skeleton > skeletons;
 list< Motion > motions;
-vector< set< unsigned int > > motions_per_subject;
-void unload_helper(Motion *motion)
+vector< set< unsigned int > > motions_per_subject; //motion indices; guarded by store_lock
+
+//what the demand paging knows about each motion (by index), all guarded
+//by store_lock:
+class Residency
 {
-  for (list< Motion >::iterator m = motions.begin(); m != motions.end(); ++m)
+public:
+  Residency() : pins(0), last_use(0), bytes(0), loading(false)
+  {
+  }
+  unsigned int pins; //only unloaded by eviction when this is 0
+  unsigned long long last_use; //use_clock when last asked for
+  size_t bytes; //memory_used() when it was loaded
+  bool loading; //some thread is loading it right now
+};
+vector< Motion * > motion_index;
+vector< Residency > residency;
+std::map< Motion const *, unsigned int > index_of;
+std::map< string, unsigned int > index_by_filename;
+unsigned long long use_clock = 0;
+size_t resident_bytes = 0;
+SDL_mutex *store_lock = NULL;
+SDL_cond *store_loaded = NULL; //broadcast whenever a load finishes
+
+//unload least recently used, unpinned motions (never 'keep') until the
+//loaded ones fit in memory_budget. store_lock must be held.
+void evict(unsigned int keep)
+{
+  while (memory_budget != 0 && resident_bytes > memory_budget)
   {
-    if (&(*m) == motion)
+    unsigned int oldest = motion_index.size();
+    for (unsigned int i = 0; i < motion_index.size(); ++i)
     {
-      list< Motion >::iterator n = motions.insert(m, Motion());
-      n->skeleton = m->skeleton;
-      n->filename = m->filename;
-      n->loaded = false;
-      n->subject = m->subject;
-      motions.erase(m);
-      break;
+      if (i == keep || residency[i].pins || residency[i].loading || !motion_index[i]->loaded) continue;
+      if (oldest == motion_index.size() || residency[i].last_use < residency[oldest].last_use)
+      {
+        oldest = i;
+      }
     }
+    if (oldest == motion_index.size()) break; //everything left is in use
+    motion_index[oldest]->unload();
+    resident_bytes -= residency[oldest].bytes;
+    residency[oldest].bytes = 0;
+  }
+}
+
+//make sure motion 'index' is loaded (waiting for another thread that's
+//loading it, or loading it here) and mark it used. store_lock must be
+//held; it is let go while loading.
+void make_resident(unsigned int index)
+{
+  Residency &r = residency[index];
+  while (r.loading)
+  {
+    SDL_CondWait(store_loaded, store_lock);
+  }
+  r.last_use = ++use_clock;
+  Motion *m = motion_index[index];
+  if (m->loaded) return;
+
+  r.loading = true;
+  SDL_UnlockMutex(store_lock);
+  m->load(false);
+  SDL_LockMutex(store_lock);
+  r.loading = false;
+  if (m->loaded)
+  {
+    r.bytes = m->memory_used();
+    resident_bytes += r.bytes;
+    evict(index);
   }
+  SDL_CondBroadcast(store_loaded);
 }
+
 }
 
 unsigned int signature = 0;
+bool decode_poses = true;
+size_t memory_budget = 0;
+string cache_path = "";
 
 #ifdef WINDOWS
 #define SEP "\\"
@@ -87,7 +155,6 @@ unsigned int signature = 0;
 
 void directory_recursion(string base_path)
 {
-  static int num_subjects = 0;
   string skeleton_path = "";
   vector< string > motion_paths;
   vector< string > dir_paths;
@@ -150,6 +217,22 @@ void directory_recursion(string base_path)
 
   sort(motion_paths.begin(), motion_paths.end());
 
+  // x.amc (or x.AMC) already reads x.bmc when there is one; don't list it
+  // twice.
+  vector< string > listed;
+  for (unsigned int i = 0; i < motion_paths.size(); ++i)
+  {
+    string const &path = motion_paths[i];
+    if (path.substr(path.size()-4,4)==".bmc")
+    {
+      string stem = path.substr(0, path.size()-4);
+      if (std::binary_search(motion_paths.begin(), motion_paths.end(), stem + ".amc")
+          || std::binary_search(motion_paths.begin(), motion_paths.end(), stem + ".AMC")) continue;
+    }
+    listed.push_back(path);
+  }
+  motion_paths.swap(listed);
+
   // if no skeleton/motions in dir, that's cool, else read them in!
   if (skeleton_path == "" || motion_paths.size()==0)
   {
@@ -173,10 +256,11 @@ void directory_recursion(string base_path)
         motions.back().skeleton = &(skeletons.back());
         motions.back().filename = motion_paths[i];
         motions.back().loaded = false;
-        motions.back().subject = num_subjects;
+        motions.back().digest = 0;
+        //(one subject per skeleton read)
+        motions.back().subject = skeletons.size() - 1;
       }
       cout << "Read " << motion_paths.size() << " motions in directory '" << base_path << "'." << endl;
-      num_subjects++;
     }
   }
   // recurse on directories in current dir
@@ -186,78 +270,488 @@ void directory_recursion(string base_path)
   }
 }
 
-void init(string base_path, bool lazy)
+namespace
+{
+
+//a fast 64-bit hash of 'bytes' bytes, eight at a time: xxHash64's round
+//and avalanche on a single lane.
+const unsigned long long HashPrime1 = 11400714785074694791ULL;
+const unsigned long long HashPrime2 = 14029467366897019727ULL;
+const unsigned long long HashPrime3 = 1609587929392839161ULL;
+const unsigned long long HashPrime4 = 9650029242287828579ULL;
+const unsigned long long HashPrime5 = 2870177450012600261ULL;
+
+inline unsigned long long rotate_left(unsigned long long x, unsigned int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+unsigned long long hash_bytes(void const *data, size_t bytes, unsigned long long seed)
 {
+  unsigned char const *at = (unsigned char const *)data;
+  unsigned long long hash = seed + HashPrime5 + bytes;
+  for (; bytes >= 8; bytes -= 8, at += 8)
+  {
+    unsigned long long word;
+    memcpy(&word, at, 8);
+    hash ^= rotate_left(word * HashPrime2, 31) * HashPrime1;
+    hash = rotate_left(hash, 27) * HashPrime1 + HashPrime4;
+  }
+  for (; bytes > 0; --bytes, ++at)
+  {
+    hash ^= (*at) * HashPrime5;
+    hash = rotate_left(hash, 11) * HashPrime1;
+  }
+  hash ^= hash >> 33;
+  hash *= HashPrime2;
+  hash ^= hash >> 29;
+  hash *= HashPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+//stands in for a motion's digest when it isn't loaded: its file's name,
+//size and modification time.
+unsigned long long file_digest(string const &filename)
+{
+  unsigned long long hash = hash_bytes(filename.data(), filename.size(), 0);
+  struct stat info;
+  if (stat(filename.c_str(), &info) == 0)
+  {
+    unsigned long long size = info.st_size;
+    unsigned long long mtime = info.st_mtime;
+    hash = hash_bytes(&size, sizeof(size), hash);
+    hash = hash_bytes(&mtime, sizeof(mtime), hash);
+  }
+  return hash;
+}
+
+//make motion() hand out m as the next index. store_lock must be held.
+void add_motion(Motion *m)
+{
+  index_of[m] = motion_index.size();
+  index_by_filename[m->filename] = motion_index.size();
+  if (m->subject >= motions_per_subject.size())
+  {
+    motions_per_subject.resize(m->subject + 1);
+  }
+  motions_per_subject[m->subject].insert(motion_index.size());
+  motion_index.push_back(m);
+  residency.push_back(Residency());
+  if (m->loaded)
+  {
+    residency.back().bytes = m->memory_used();
+    resident_bytes += residency.back().bytes;
+  }
+}
+
+//start init over on base_path: forget every motion and skeleton and read
+//the directories again.
+void reset(string const &base_path)
+{
+  if (store_lock == NULL)
+  {
+    store_lock = SDL_CreateMutex();
+    store_loaded = SDL_CreateCond();
+    assert(store_lock != NULL);
+    assert(store_loaded != NULL);
+  }
+  motion_index.clear();
+  residency.clear();
+  index_of.clear();
+  index_by_filename.clear();
+  motions_per_subject.clear();
+  resident_bytes = 0;
   skeletons.clear();
   motions.clear();
 
+  //starts with '.', so directory_recursion won't look in it:
+  cache_path = base_path + SEP + ".cache";
+
   directory_recursion(base_path);
 
-  if (!lazy)
+  //every subject, even if none of its motions load:
+  motions_per_subject.resize(skeletons.size());
+
+  //make_resident holds on to residency entries while it loads with the
+  //lock let go, so they mustn't move as motions are added:
+  residency.reserve(motions.size());
+}
+
+//init_progressive's loading, on its own thread; guarded by store_lock:
+SDL_Thread *loader = NULL;
+bool loading_finished = true;
+bool stop_requested = false;
+unsigned int loader_threads = 0;
+
+//loads motions[piece]. init reports on them all afterward; when
+//progressive, each is reported and handed to motion() as soon as every
+//motion before it is done, so indices come out as init's would.
+class LoadJob : public ParallelJob
+{
+public:
+  LoadJob() : metadata_only(false), progressive(false), published(0), frames(0), length(0.0f)
+  {
+  }
+  virtual void run(unsigned int piece)
   {
-    float length = 0.0;
-    unsigned int frames = 0;
-    for (list< Motion >::iterator m = motions.begin(); m != motions.end(); ++m)
+    if (progressive)
     {
-      if (m->load())
+      SDL_LockMutex(store_lock);
+      bool skip = stop_requested;
+      SDL_UnlockMutex(store_lock);
+      if (skip)
       {
-        frames += m->frames();
-        length += m->length();
+        finish(piece);
+        return;
       }
-      else
+    }
+    if (metadata_only)
+    {
+      motions[piece]->digest = digests[piece] = file_digest(motions[piece]->filename);
+      return;
+    }
+    unsigned int start = SDL_GetTicks();
+    loaded[piece] = motions[piece]->load(false);
+    digests[piece] = motions[piece]->digest;
+    ticks[piece] = SDL_GetTicks() - start;
+    if (progressive) finish(piece);
+  }
+  void resize()
+  {
+    loaded.resize(motions.size(), 0);
+    ticks.resize(motions.size(), 0);
+    digests.resize(motions.size(), 0);
+    finished.resize(motions.size(), 0);
+  }
+  //say how loading motions[index] went:
+  void report(unsigned int index)
+  {
+    Motion const &m = *motions[index];
+    if (loaded[index])
+    {
+      cout << "Read " << m.filename << " (" << m.frames() << " frames) in " << ticks[index] << " ms" << endl;
+      frames += m.frames();
+      length += m.length();
+    }
+    else
+    {
+      cout << "Could not load from '" << m.filename << "'." << endl;
+    }
+  }
+  vector< Motion * > motions;
+  vector< char > loaded; //(not vector< bool >; pieces write these at once)
+  vector< unsigned int > ticks;
+  //each motion's digest as the job left it (once published, a motion can
+  //be unloaded and loaded again by other threads):
+  vector< unsigned long long > digests;
+
+  bool metadata_only; //don't load, just set each digest from file_digest
+  bool progressive;
+  vector< char > finished; //guarded by store_lock, like the rest below
+  unsigned int published; //motions[0 .. published-1] have been dealt with
+  unsigned int frames;
+  float length;
+
+private:
+  void finish(unsigned int piece)
+  {
+    SDL_LockMutex(store_lock);
+    finished[piece] = 1;
+    bool added = false;
+    while (published < motions.size() && finished[published])
+    {
+      if (!stop_requested) report(published);
+      if (loaded[published])
       {
-        cout << "Could not load from '" << m->filename << "'." << endl;
-        list< Motion >::iterator old = m;
-        ++m;
-        motions.erase(old);
-        --m;
+        add_motion(motions[published]);
+        added = true;
       }
+      ++published;
+    }
+    if (added)
+    {
+      evict(motion_index.size());
+      SDL_CondBroadcast(store_loaded);
     }
-    cout << "Loaded " << length << " seconds of motion (" << frames << " frames)." << endl;
+    SDL_UnlockMutex(store_lock);
   }
-  else
+};
+
+LoadJob *progress_job = NULL;
+
+//drop the motions that didn't load, then work out the signature from the
+//rest's digests, in order:
+void finish_init(LoadJob const &job)
+{
+  unsigned long long sig = 0;
+  unsigned int index = 0;
+  for (list< Motion >::iterator m = motions.begin(); m != motions.end(); ++index)
   {
-    cout << "Lazy loading of motions enabled." << endl;
+    if (job.loaded[index])
+    {
+      sig = hash_bytes(&job.digests[index], sizeof(job.digests[index]), sig);
+      ++m;
+    }
+    else
+    {
+      m = motions.erase(m);
+    }
   }
+  cout << "Computing signature" << endl;
+  signature = (unsigned int)(sig ^ (sig >> 32));
+  cout << "Signature is " << signature << endl;
+}
 
+int background_load(void *)
+{
+  LoadJob &job = *progress_job;
+  unsigned int start = SDL_GetTicks();
+  parallel_for(job, job.motions.size(), loader_threads);
+  unsigned int elapsed = SDL_GetTicks() - start;
 
-  cout << "Computing signature" << endl;
-  long long sig = 0;
+  SDL_LockMutex(store_lock);
+  bool stopped = stop_requested;
+  SDL_UnlockMutex(store_lock);
+
+  //nothing else looks at the list of motions or the signature until
+  //loading_done() says so:
+  if (!stopped)
+  {
+    cout << "Loaded " << job.length << " seconds of motion (" << job.frames << " frames) in " << elapsed / 1000.0f << " seconds";
+    unsigned int threads = loader_threads;
+    if (threads == 0) threads = processor_count();
+    cout << " on " << std::min< unsigned int >(threads, job.motions.size()) << " threads." << endl;
+  }
+  finish_init(job);
+
+  SDL_LockMutex(store_lock);
+  loading_finished = true;
+  SDL_CondBroadcast(store_loaded);
+  SDL_UnlockMutex(store_lock);
+  return 0;
+}
+
+}
+
+void init(string base_path, bool lazy, unsigned int threads)
+{
+  stop_loading();
+  reset(base_path);
+
+  LoadJob job;
   for (list< Motion >::iterator m = motions.begin(); m != motions.end(); ++m)
   {
-    unsigned char * c = (unsigned char *)(&m->data[0]);
-    unsigned char *end = (unsigned char *)(&m->data[m->data.size()-1]+1);
-    while (c != end)
+    job.motions.push_back(&(*m));
+  }
+  job.resize();
+
+  if (!lazy)
+  {
+    //every motion loads on its own, so spread them over the threads; the
+    //reporting (and dropping of the ones that failed) happens afterward,
+    //in directory order, so it comes out the same whatever the count.
+    unsigned int start = SDL_GetTicks();
+    parallel_for(job, job.motions.size(), threads);
+    unsigned int elapsed = SDL_GetTicks() - start;
+
+    for (unsigned int index = 0; index < job.motions.size(); ++index)
     {
-      sig = (sig * 256) % 1610612741LL;
-      sig = (sig + (long long)(*c)) % 1610612741LL;
-      ++c;
+      job.report(index);
     }
+    cout << "Loaded " << job.length << " seconds of motion (" << job.frames << " frames) in " << elapsed / 1000.0f << " seconds";
+    if (threads == 0) threads = processor_count();
+    cout << " on " << std::min< unsigned int >(threads, job.motions.size()) << " threads." << endl;
   }
-  signature = (unsigned int)(sig & 0xffffffff);
-  cout << "Signature is " << signature << endl;
-  return;
+  else
+  {
+    cout << "Lazy loading of motions enabled." << endl;
+    //nothing is loaded to hash, so the signature comes from what the
+    //files look like instead (and none have failed yet):
+    job.metadata_only = true;
+    parallel_for(job, job.motions.size(), threads);
+    job.loaded.assign(job.motions.size(), 1);
+  }
+  finish_init(job);
+
+  //(after finish_init has dropped the motions that failed to load)
+  SDL_LockMutex(store_lock);
+  for (list< Motion >::iterator m = motions.begin(); m != motions.end(); ++m)
+  {
+    add_motion(&(*m));
+  }
+  evict(motion_index.size());
+  SDL_UnlockMutex(store_lock);
+}
+
+void init_progressive(string base_path, unsigned int threads)
+{
+  stop_loading();
+  reset(base_path);
+
+  progress_job = new LoadJob;
+  progress_job->progressive = true;
+  for (list< Motion >::iterator m = motions.begin(); m != motions.end(); ++m)
+  {
+    progress_job->motions.push_back(&(*m));
+  }
+  progress_job->resize();
+
+  SDL_LockMutex(store_lock);
+  loading_finished = false;
+  stop_requested = false;
+  loader_threads = threads;
+  SDL_UnlockMutex(store_lock);
+
+  cout << "Loading " << motions.size() << " motions in the background." << endl;
+  loader = SDL_CreateThread(background_load, NULL);
+  if (loader == NULL)
+  {
+    //no thread to do it on, so load them here:
+    background_load(NULL);
+  }
+}
+
+bool loading_done()
+{
+  if (store_lock == NULL) return true;
+  SDL_LockMutex(store_lock);
+  bool done = loading_finished;
+  SDL_UnlockMutex(store_lock);
+  return done;
+}
+
+unsigned int wait_for_motions(unsigned int count)
+{
+  if (store_lock == NULL) return 0;
+  SDL_LockMutex(store_lock);
+  while (motion_index.size() < count && !loading_finished)
+  {
+    SDL_CondWait(store_loaded, store_lock);
+  }
+  unsigned int have = motion_index.size();
+  SDL_UnlockMutex(store_lock);
+  return have;
+}
+
+void stop_loading()
+{
+  if (progress_job == NULL) return;
+  SDL_LockMutex(store_lock);
+  stop_requested = true;
+  SDL_UnlockMutex(store_lock);
+  if (loader != NULL) SDL_WaitThread(loader, NULL);
+  loader = NULL;
+  delete progress_job;
+  progress_job = NULL;
+}
+
+string cache_file(string const &name)
+{
+  //fine if it's already there:
+#ifdef WINDOWS
+  _mkdir(cache_path.c_str());
+#else
+  mkdir(cache_path.c_str(), 0777);
+#endif
+  return cache_path + SEP + name;
 }
 
 unsigned int motion_count()
 {
-  return motions.size();
+  if (store_lock == NULL) return 0;
+  SDL_LockMutex(store_lock);
+  unsigned int count = motion_index.size();
+  SDL_UnlockMutex(store_lock);
+  return count;
 }
 
 Motion const &motion(unsigned int index)
 {
-  assert(index < motions.size());
-  list< Motion >::const_iterator m = motions.begin();
-  for (unsigned int i = 0; i < index; ++i) ++m;
-  return *m;
+  return motion_nonconst(index);
 }
 
 Motion &motion_nonconst(unsigned int index)
 {
-  assert(index < motions.size());
-  list< Motion >::iterator m = motions.begin();
-  for (unsigned int i = 0; i < index; ++i) ++m;
-  return *m;
+  SDL_LockMutex(store_lock);
+  assert(index < motion_index.size());
+  make_resident(index);
+  Motion &m = *motion_index[index];
+  SDL_UnlockMutex(store_lock);
+  return m;
+}
+
+bool find_motion(string const &filename, unsigned int &index)
+{
+  if (store_lock == NULL) return false;
+  SDL_LockMutex(store_lock);
+  std::map< string, unsigned int >::const_iterator found = index_by_filename.find(filename);
+  bool have = (found != index_by_filename.end());
+  if (have) index = found->second;
+  SDL_UnlockMutex(store_lock);
+  return have;
+}
+
+unsigned int subject_count()
+{
+  if (store_lock == NULL) return 0;
+  SDL_LockMutex(store_lock);
+  unsigned int count = motions_per_subject.size();
+  SDL_UnlockMutex(store_lock);
+  return count;
+}
+
+set< unsigned int > subject_motions(unsigned int subject)
+{
+  set< unsigned int > indices;
+  if (store_lock == NULL) return indices;
+  SDL_LockMutex(store_lock);
+  if (subject < motions_per_subject.size())
+  {
+    indices = motions_per_subject[subject];
+  }
+  SDL_UnlockMutex(store_lock);
+  return indices;
+}
+
+void pin(Motion const &motion)
+{
+  SDL_LockMutex(store_lock);
+  std::map< Motion const *, unsigned int >::const_iterator found = index_of.find(&motion);
+  assert(found != index_of.end());
+  ++residency[found->second].pins;
+  make_resident(found->second);
+  SDL_UnlockMutex(store_lock);
+}
+
+Motion const &pin(unsigned int index)
+{
+  SDL_LockMutex(store_lock);
+  assert(index < motion_index.size());
+  ++residency[index].pins;
+  make_resident(index);
+  Motion const &m = *motion_index[index];
+  SDL_UnlockMutex(store_lock);
+  return m;
+}
+
+void unpin(Motion const &motion)
+{
+  SDL_LockMutex(store_lock);
+  std::map< Motion const *, unsigned int >::const_iterator found = index_of.find(&motion);
+  assert(found != index_of.end());
+  assert(residency[found->second].pins > 0);
+  --residency[found->second].pins;
+  evict(motion_index.size());
+  SDL_UnlockMutex(store_lock);
+}
+
+size_t memory_used()
+{
+  SDL_LockMutex(store_lock);
+  size_t used = resident_bytes;
+  SDL_UnlockMutex(store_lock);
+  return used;
 }
 
 void Motion::get_delta(unsigned int frame_from, unsigned int frame_to, Character::StateDelta &into) const
@@ -276,6 +770,61 @@ void Motion::get_delta(unsigned int frame_from, unsigned int frame_to, Character
 //	into.clear();
 //}
 
+PoseBlock::PoseBlock() : first(0), frames(0), bones(0), skeleton(NULL)
+{
+}
+
+void PoseBlock::resize(unsigned int _frames, unsigned int _bones)
+{
+  frames = _frames;
+  bones = _bones;
+  positions.resize(3 * frames);
+  orientations.resize((bones + 1) * 4 * frames);
+}
+
+void PoseBlock::set_pose(unsigned int frame, Character::Pose const &pose)
+{
+  assert(frame < frames);
+  assert(pose.bone_orientations.size() == bones);
+  for (unsigned int c = 0; c < 3; ++c)
+  {
+    root_position(c)[frame] = pose.root_position.c[c];
+  }
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    orientation(0, c)[frame] = pose.root_orientation.c[c];
+  }
+  for (unsigned int b = 0; b < bones; ++b)
+  {
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      orientation(b + 1, c)[frame] = pose.bone_orientations[b].c[c];
+    }
+  }
+}
+
+void PoseBlock::get_pose(unsigned int frame, Character::Pose &into) const
+{
+  assert(frame < frames);
+  into.skeleton = skeleton;
+  into.bone_orientations.resize(bones);
+  for (unsigned int c = 0; c < 3; ++c)
+  {
+    into.root_position.c[c] = root_position(c)[frame];
+  }
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    into.root_orientation.c[c] = orientation(0, c)[frame];
+  }
+  for (unsigned int b = 0; b < bones; ++b)
+  {
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      into.bone_orientations[b].c[c] = orientation(b + 1, c)[frame];
+    }
+  }
+}
+
 void Motion::get_angles(unsigned int frame, Character::Angles &into) const
 {
   assert(loaded);
@@ -290,10 +839,60 @@ void Motion::get_pose(unsigned int frame, Character::Pose &into) const
   //simple!
   assert(skeleton);
   assert(frame < frames());
+  if (!decoded_orientations.empty())
+  {
+    //already decoded, just copy it (bone_orientations keeps its storage):
+    unsigned int bones = skeleton->bones.size();
+    Quatf const *orientations = &(decoded_orientations[frame * (bones + 1)]);
+    into.skeleton = skeleton;
+    into.root_position = decoded_root_positions[frame];
+    into.root_orientation = orientations[0];
+    into.bone_orientations.assign(orientations + 1, orientations + 1 + bones);
+    return;
+  }
   assert((frame + 1) * skeleton->frame_size <= data.size());
   skeleton->build_pose(&(data[0]) + frame * skeleton->frame_size, into);
 }
 
+void Motion::get_poses(unsigned int first, unsigned int count, PoseBlock &into) const
+{
+  assert(loaded);
+  assert(skeleton);
+  assert(first + count <= frames());
+  unsigned int bones = skeleton->bones.size();
+  into.resize(count, bones);
+  into.first = first;
+  into.skeleton = skeleton;
+  if (count == 0) return;
+  if (!decoded_orientations.empty())
+  {
+    //already decoded; just turn it on its side, a plane at a time:
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+      float *plane = into.root_position(c);
+      Vector3f const *src = &(decoded_root_positions[first]);
+      for (unsigned int f = 0; f < count; ++f)
+      {
+        plane[f] = src[f].c[c];
+      }
+    }
+    for (unsigned int q = 0; q <= bones; ++q)
+    {
+      Quatf const *src = &(decoded_orientations[first * (bones + 1) + q]);
+      for (unsigned int c = 0; c < 4; ++c)
+      {
+        float *plane = into.orientation(q, c);
+        for (unsigned int f = 0; f < count; ++f)
+        {
+          plane[f] = src[f * (bones + 1)].c[c];
+        }
+      }
+    }
+    return;
+  }
+  skeleton->build_poses(&(data[0]) + first * skeleton->frame_size, count, into);
+}
+
 void Motion::get_local_pose(unsigned int frame, Character::Pose &into) const
 {
   assert(loaded);
@@ -336,6 +935,22 @@ float Motion::get_distance_to_floor(unsigned int frame) const
   return distance_to_floor[frame];
 }
 
+float const *Motion::get_joint_positions(unsigned int frame) const
+{
+  assert(loaded);
+  assert(frame < frames());
+  assert((frame + 1) * joint_stride() <= joint_positions.size());
+  return &(joint_positions[0]) + frame * joint_stride();
+}
+
+unsigned int Motion::joint_stride() const
+{
+  assert(skeleton);
+  //rows are zero-padded so the distance kernel can always use whole vectors.
+  unsigned int const width = DistanceKernelWidth;
+  return (skeleton->bones.size() * 3 + width - 1) / width * width;
+}
+
 int Motion::get_annotation(unsigned int frame) const
 {
   assert(loaded);
@@ -543,7 +1158,7 @@ vector< vector< float > > Motion::get_sensors() const
   return sensors;
 }
 
-bool Motion::load()
+bool Motion::load(bool report)
 {
   if (loaded)
   {
@@ -555,36 +1170,77 @@ bool Motion::load()
     return false;
   }
   loaded = true;
-  cout << "Read " << filename << " (" << frames() << " frames)" << endl;
+  digest = data.empty() ? 0 : hash_bytes(&data[0], data.size() * sizeof(double), 0);
+  if (report)
+  {
+    cout << "Read " << filename << " (" << frames() << " frames)" << endl;
+  }
   annotations.clear();
   annotations.resize(frames(), 0);
   load_annotations();
+  if (decode_poses)
+  {
+    calculate_decoded_poses();
+  }
   calculate_control_data();
+  calculate_joint_positions();
   load_sensors();
   return true;
 }
 
+namespace
+{
+
+template< typename T >
+void free_vector(vector< T > &v)
+{
+  vector< T >().swap(v);
+}
+
+template< typename T >
+size_t vector_bytes(vector< T > const &v)
+{
+  return v.capacity() * sizeof(T);
+}
+
+}
+
 void Motion::unload()
 {
-  //Sleazy unload trick:
-  unload_helper(this);
-  return;
-  /*
-  if (!loaded) {
-  	cerr << "Double unloading a motion." << endl;
-  }
-  data.clear();
-  if (data.capacity() != 0) {
-  	cout << "Data still using " << data.capacity() * sizeof(double) << " bytes." << endl;
-  	//assert(false);
+  if (!loaded)
+  {
+    cerr << "Double unloading a motion." << endl;
   }
-  control_data.clear();
-  local_root.clear();
-  smooth_root.clear();
-  distance_to_floor.clear();
-  annotations.clear();
+  free_vector(data);
+  free_vector(control_data);
+  free_vector(local_root);
+  free_vector(smooth_root);
+  free_vector(distance_to_floor);
+  free_vector(decoded_root_positions);
+  free_vector(decoded_orientations);
+  free_vector(joint_positions);
+  free_vector(annotations);
+  free_vector(sensors);
+  free_vector(accelerations);
   loaded = false;
-  */
+}
+
+size_t Motion::memory_used() const
+{
+  size_t bytes = vector_bytes(data) + vector_bytes(control_data)
+    + vector_bytes(local_root) + vector_bytes(smooth_root)
+    + vector_bytes(distance_to_floor) + vector_bytes(decoded_root_positions)
+    + vector_bytes(decoded_orientations) + vector_bytes(joint_positions)
+    + vector_bytes(annotations);
+  for (unsigned int i = 0; i < sensors.size(); ++i)
+  {
+    bytes += vector_bytes(sensors[i]);
+  }
+  for (unsigned int i = 0; i < accelerations.size(); ++i)
+  {
+    bytes += vector_bytes(accelerations[i]);
+  }
+  return bytes;
 }
 
 unsigned int Motion::frames() const
@@ -609,23 +1265,29 @@ void Motion::calculate_control_data()
   smooth_root.resize(frames());
   distance_to_floor.clear();
   distance_to_floor.resize(frames());
+  //both passes below want every pose and its world bones; work them all
+  //out at once:
+  PoseBlock block;
+  get_poses(0, frames(), block);
+  Character::WorldBonesBlock wb;
+  get_world_bones(block, wb);
+  assert(wb.bones == skeleton->bones.size());
+  vector< float > masses(wb.bones);
+  for (unsigned int b = 0; b < wb.bones; ++b)
+  {
+    masses[b] = powf((float)skeleton->bones[b].radius, 2.0f) * (float)M_PI * (float)skeleton->bones[b].density * (float)skeleton->bones[b].length;
+  }
   //calculate smooth root
   {
     for (unsigned int i = 0; i < frames(); ++i)
     {
-      Character::Pose pose;
-      get_pose(i, pose);
       //we'll project the center-of-mass onto the floor:
-      Character::WorldBones wb;
-      get_world_bones(pose, wb);
-      assert(wb.bases.size() == pose.skeleton->bones.size());
-      assert(wb.tips.size() == pose.skeleton->bones.size());
       smooth_root[i].position = make_vector(0.0f, 0.0f, 0.0f);
       float mass = 0.0f;
-      for (unsigned int b = 0; b < wb.bases.size(); ++b)
+      for (unsigned int b = 0; b < wb.bones; ++b)
       {
-        float m = powf((float)pose.skeleton->bones[b].radius, 2.0f) * (float)M_PI * (float)pose.skeleton->bones[b].density * (float)pose.skeleton->bones[b].length;
-        smooth_root[i].position += 0.5f * m * (wb.bases[b] + wb.tips[b]);
+        float m = masses[b];
+        smooth_root[i].position += 0.5f * m * (wb.base_at(b, i) + wb.tip_at(b, i));
         mass += m;
       }
       if (mass == 0.0f)
@@ -637,7 +1299,7 @@ void Motion::calculate_control_data()
         smooth_root[i].position /= mass;
       }
       smooth_root[i].position.y = 0.0f; //project.
-      smooth_root[i].orientation = get_yaw_angle(pose.root_orientation);
+      smooth_root[i].orientation = get_yaw_angle(block.orientation_at(0, i));
       if (i > 0)
       {
         //fix up orientation to prevent sudden spins.
@@ -674,21 +1336,18 @@ void Motion::calculate_control_data()
   }
   for (unsigned int i = 0; i < frames(); ++i)
   {
-    Character::Pose pose;
-    get_pose(i, pose);
     Quatf inv = -rotation(smooth_root[i].orientation, make_vector(0.0f, 1.0f, 0.0f));
-    local_root[i].position = rotate(pose.root_position - smooth_root[i].position, inv);
-    local_root[i].orientation = multiply(inv, pose.root_orientation);
-    Character::WorldBones world_bones;
-    get_world_bones(pose, world_bones);
-    assert(world_bones.tips.size() == world_bones.bases.size());
-    for (unsigned int b = 0; b < world_bones.tips.size(); ++b)
+    local_root[i].position = rotate(block.root_position_at(i) - smooth_root[i].position, inv);
+    local_root[i].orientation = multiply(inv, block.orientation_at(0, i));
+    for (unsigned int b = 0; b < wb.bones; ++b)
     {
-      if (b == 0) distance_to_floor[i] = world_bones.tips[b].y;
-      if (world_bones.tips[b].y < distance_to_floor[i])
-        distance_to_floor[i] = world_bones.tips[b].y;
-      if (world_bones.bases[b].y < distance_to_floor[i])
-        distance_to_floor[i] = world_bones.bases[b].y;
+      float tip = wb.tip(b, 1)[i];
+      float base = wb.base(b, 1)[i];
+      if (b == 0) distance_to_floor[i] = tip;
+      if (tip < distance_to_floor[i])
+        distance_to_floor[i] = tip;
+      if (base < distance_to_floor[i])
+        distance_to_floor[i] = base;
     }
   }
   control_data.clear();
@@ -720,4 +1379,65 @@ void Motion::calculate_control_data()
   control_data[frames() - 1].clear();
 }
 
+void Motion::calculate_decoded_poses()
+{
+  decoded_root_positions.clear();
+  decoded_orientations.clear();
+  unsigned int bones = skeleton->bones.size();
+  vector< Vector3f > root_positions(frames());
+  vector< Quatf > orientations(frames() * (bones + 1));
+  //decode it once, a block of frames at a time (get_poses decodes, since
+  //there's nothing stored yet):
+  unsigned int const BlockFrames = 256;
+  PoseBlock block;
+  for (unsigned int first = 0; first < frames(); first += BlockFrames)
+  {
+    unsigned int count = std::min(BlockFrames, frames() - first);
+    get_poses(first, count, block);
+    for (unsigned int f = 0; f < count; ++f)
+    {
+      root_positions[first + f] = block.root_position_at(f);
+      for (unsigned int q = 0; q <= bones; ++q)
+      {
+        orientations[(first + f) * (bones + 1) + q] = block.orientation_at(q, f);
+      }
+    }
+  }
+  decoded_root_positions.swap(root_positions);
+  decoded_orientations.swap(orientations);
+}
+
+void Motion::calculate_joint_positions()
+{
+  joint_positions.clear();
+  joint_positions.resize(frames() * joint_stride());
+  if (frames() == 0) return;
+  PoseBlock block;
+  get_poses(0, frames(), block);
+  //only the shape of the pose is wanted, so drop the root:
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    float *plane = block.orientation(0, c);
+    std::fill(plane, plane + frames(), (c == 3 ? 1.0f : 0.0f));
+    if (c < 3)
+    {
+      plane = block.root_position(c);
+      std::fill(plane, plane + frames(), 0.0f);
+    }
+  }
+  Character::WorldBonesBlock world_bones;
+  get_world_bones(block, world_bones);
+  assert(world_bones.bones * 3 <= joint_stride());
+  for (unsigned int i = 0; i < frames(); ++i)
+  {
+    float *row = &(joint_positions[0]) + i * joint_stride();
+    for (unsigned int b = 0; b < world_bones.bones; ++b)
+    {
+      row[3 * b + 0] = world_bones.base(b, 0)[i];
+      row[3 * b + 1] = world_bones.base(b, 1)[i];
+      row[3 * b + 2] = world_bones.base(b, 2)[i];
+    }
+  }
+}
+
 } //namespace Library
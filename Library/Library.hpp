@@ -7,6 +7,8 @@
 
 #include <string>
 #include <set>
+#include <cstddef>
+#include <assert.h>
 
 namespace Library
 {
@@ -34,6 +36,69 @@ extern const char *AnnotationNames[AnnotationCount];
 //list of colors associated with the annotations above.
 extern Vector3f AnnotationColors[AnnotationCount];
 
+//many consecutive frames' poses (see Motion::get_poses), stored one
+//component at a time so a pass over a whole clip can run across frames.
+class PoseBlock
+{
+public:
+  PoseBlock();
+  //make room for 'frames' poses of 'bones' bones. Keeps its storage, so
+  //filling the same block again doesn't allocate.
+  void resize(unsigned int frames, unsigned int bones);
+
+  //component c (x, y, z) of the root position, one value per frame:
+  inline float *root_position(unsigned int c)
+  {
+    assert(c < 3 && frames);
+    return &(positions[c * frames]);
+  }
+  inline float const *root_position(unsigned int c) const
+  {
+    assert(c < 3 && frames);
+    return &(positions[c * frames]);
+  }
+  //component c (x, y, z, w) of orientation q -- the root's for q == 0,
+  //bone q - 1's after that -- one value per frame:
+  inline float *orientation(unsigned int q, unsigned int c)
+  {
+    assert(q <= bones && c < 4 && frames);
+    return &(orientations[(q * 4 + c) * frames]);
+  }
+  inline float const *orientation(unsigned int q, unsigned int c) const
+  {
+    assert(q <= bones && c < 4 && frames);
+    return &(orientations[(q * 4 + c) * frames]);
+  }
+
+  //one frame's worth:
+  inline Vector3f root_position_at(unsigned int frame) const
+  {
+    return make_vector(root_position(0)[frame], root_position(1)[frame], root_position(2)[frame]);
+  }
+  inline Quatf orientation_at(unsigned int q, unsigned int frame) const
+  {
+    Quatf ret;
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      ret.c[c] = orientation(q, c)[frame];
+    }
+    return ret;
+  }
+
+  //put pose into / take it out of slot 'frame':
+  void set_pose(unsigned int frame, Character::Pose const &pose);
+  void get_pose(unsigned int frame, Character::Pose &into) const;
+
+  unsigned int first; //motion frame in slot 0.
+  unsigned int frames;
+  unsigned int bones;
+  Library::Skeleton const *skeleton;
+
+private:
+  vector< float > positions;
+  vector< float > orientations;
+};
+
 //each motion provides a bare interface to many frames of poses:
 // (each pose annotated with a convenient state vector as well!)
 class Motion
@@ -42,6 +107,10 @@ public:
   //void get_state(unsigned int frame, Character::State &into) const;
   void get_angles(unsigned int frame, Character::Angles &into) const;
   void get_pose(unsigned int frame, Character::Pose &into) const;
+  //frames first .. first + count - 1, the same as get_pose would give
+  //them (to within float rounding if decode_poses is off, since these
+  //come from Skeleton::build_poses), all at once:
+  void get_poses(unsigned int first, unsigned int count, PoseBlock &into) const;
   //call get_pose then call get_local_root on it.
   void get_local_pose(unsigned int frame, Character::Pose &into) const;
   //delta is aggregate control over frame_from to frame_to -- also
@@ -58,6 +127,12 @@ public:
 
   float get_distance_to_floor(unsigned int frame) const;
 
+  //fetch joint positions (bone bases, root translation and orientation
+  //removed) at frame, as joint_stride() floats -- x,y,z per bone, then
+  //zeros up to a multiple of DistanceKernelWidth:
+  float const *get_joint_positions(unsigned int frame) const;
+  unsigned int joint_stride() const;
+
   int get_annotation(unsigned int frame) const;
   void add_annotation(unsigned int frame, Annotation annotation);
   void clear_annotation(unsigned int frame, Annotation annotation);
@@ -72,8 +147,13 @@ public:
   bool save_accelerations() const;
 
   // load motion data into memory sometime after motion is inited
-  bool load();
-  void unload(); //note: your reference may become INVALID after calling this!
+  // (report -> say so on cout)
+  bool load(bool report = true);
+  //free everything load made; the motion can be loaded again later.
+  //(annotations and sensors not yet saved are lost.)
+  void unload();
+  //bytes held by everything load made:
+  size_t memory_used() const;
 
   unsigned int frames() const; //length in timesteps.
   float length() const; //length in time.
@@ -111,27 +191,107 @@ public:
   //store the minimum distance from any bone to the floor.
   vector< float > distance_to_floor;
 
+  //fill decoded_root_positions and decoded_orientations; called by load
+  //(before anything that uses get_pose) if decode_poses is set.
+  void calculate_decoded_poses();
+
+  //every frame's pose, as skeleton->build_poses makes it (build_pose's, to
+  //within float rounding):
+  //root position per frame, and per frame the root orientation followed
+  //by every bone's orientation. When these are filled in, get_pose is
+  //just a copy.
+  vector< Vector3f > decoded_root_positions;
+  vector< Quatf > decoded_orientations;
+
+  //fill joint_positions; called by load.
+  void calculate_joint_positions();
+
+  //joint positions for every frame, one row of joint_stride() floats per
+  //frame. Used by DistanceMap so each frame only goes through FK once.
+  vector< float > joint_positions;
+
   string filename;
   unsigned int subject;
   vector< int > annotations; // int bitset per frame
   vector< vector< float > > sensors; // vector of sensors each frame
   bool loaded;
+  //64-bit hash of data, set by load (and kept through unload); for caching
+  //things about this motion alone. Until the first load, if the library
+  //is lazy, a hash of the file's name, size and modification time.
+  unsigned long long digest;
 };
 
 
+//whether load decodes every frame's pose up front (Motion::decoded_*);
+//costs about as much memory again as the angle data. Default true.
+extern bool decode_poses;
+
+//most bytes of loaded motion data to keep around (0 -> no limit, the
+//default). When loading a motion takes the library over this, the motions
+//used longest ago that aren't pinned are unloaded until it fits again.
+extern size_t memory_budget;
+
 //read in the library
 // - expects directories with one more dirs and/or one .asf, many .amc's
-void init(string base_path = "data", bool lazy = false);
+// - unless lazy, loads the motions on 'threads' threads (0 -> one per
+//   processor); the library comes out the same whatever the count.
+// - if lazy, motions are loaded the first time motion() asks for them.
+void init(string base_path = "data", bool lazy = false, unsigned int threads = 0);
+
+//like init, but returns once the directories have been read and loads the
+//motions on background threads. motion_count() grows as they finish, and
+//the indices come out as init's would (motions that fail to load are
+//left out). signature is only set once loading_done().
+void init_progressive(string base_path = "data", unsigned int threads = 0);
+//true unless init_progressive is still loading:
+bool loading_done();
+//wait until at least 'count' motions are loaded (or there are no more to
+//come); returns motion_count().
+unsigned int wait_for_motions(unsigned int count);
+//stop init_progressive's loading (dropping motions not yet loaded) and
+//wait for it to wind up. Call before exiting while it may be loading.
+void stop_loading();
 
 // recursively add all .afs/.amc's starting at base_path. Called by init.
 void directory_recursion(string base_path);
 
-//access some list of motions:
+//access some list of motions; each is loaded first if it isn't already
+//(and left unloaded if that fails). References stay good for as long as
+//the library does, but the motion behind one may be unloaded again by a
+//later call to load another unless it is pinned. Safe to call from any
+//thread.
 unsigned int motion_count();
 Motion const &motion(unsigned int index);
 Motion       &motion_nonconst(unsigned int index);
 
-//in case you want to cache data:
+//index of the motion read from 'filename' (exactly as in Motion::filename);
+//false if there isn't one.
+bool find_motion(string const &filename, unsigned int &index);
+
+//subjects are numbered by the directories (each with its own skeleton)
+//they were found in; Motion::subject says which a motion belongs to.
+unsigned int subject_count();
+//indices of the subject's motions, in order:
+set< unsigned int > subject_motions(unsigned int subject);
+
+//keep a motion loaded (loading it now if need be) until a matching unpin;
+//pins nest.
+void pin(Motion const &motion);
+//the same for motion 'index', returning it. Use this rather than motion()
+//then pin(), which leaves a moment for it to be unloaded in between.
+Motion const &pin(unsigned int index);
+void unpin(Motion const &motion);
+
+//bytes of motion data loaded right now:
+size_t memory_used();
+
+//in case you want to cache data: a hash of every motion's digest, in
+//order. (If lazy, the digests come from the files, so this differs from
+//the non-lazy signature of the same library.)
 extern unsigned int signature;
+//...and somewhere to put it (base_path/.cache, set by init):
+extern string cache_path;
+//path of file 'name' in cache_path; makes cache_path if it isn't there yet.
+string cache_file(string const &name);
 };
 #endif //LIBRARY_HPP
@@ -0,0 +1,355 @@
+#include "MotionGraph.hpp"
+
+#include "DistanceMap.hpp"
+#include "Parallel.hpp"
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+using std::vector;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::ios;
+
+namespace Library
+{
+
+namespace
+{
+
+const char GraphMagic[4] = {'M', 'G', 'R', 'F'};
+const unsigned int GraphVersion = 1;
+
+//per-motion box around every frame's joint positions; no frame of one
+//motion can be closer to a frame of another than their boxes are.
+class JointBounds
+{
+public:
+  vector< float > min;
+  vector< float > max;
+  void compute(Motion const &motion)
+  {
+    unsigned int stride = motion.joint_stride();
+    min.assign(motion.get_joint_positions(0), motion.get_joint_positions(0) + stride);
+    max = min;
+    for (unsigned int f = 1; f < motion.frames(); ++f)
+    {
+      float const *row = motion.get_joint_positions(f);
+      for (unsigned int c = 0; c < stride; ++c)
+      {
+        if (row[c] < min[c]) min[c] = row[c];
+        if (row[c] > max[c]) max[c] = row[c];
+      }
+    }
+  }
+  //lower bound on the (squared joint position) distance between any frame
+  //in this box and any frame in 'other':
+  float distance_bound(JointBounds const &other) const
+  {
+    float bound = 0.0f;
+    for (unsigned int c = 0; c < min.size(); ++c)
+    {
+      float gap = 0.0f;
+      if (other.min[c] > max[c]) gap = other.min[c] - max[c];
+      if (min[c] > other.max[c]) gap = min[c] - other.max[c];
+      bound += gap * gap;
+    }
+    return bound;
+  }
+};
+
+//filename without its directory; the library may have been loaded from a
+//different path since the graph was built.
+string base_name(string const &filename)
+{
+  string::size_type sep = filename.find_last_of("/\\");
+  if (sep == string::npos) return filename;
+  return filename.substr(sep + 1);
+}
+
+bool cheaper_edge(MotionGraph::Edge const &a, MotionGraph::Edge const &b)
+{
+  if (a.cost != b.cost) return a.cost < b.cost;
+  if (a.to_motion != b.to_motion) return a.to_motion < b.to_motion;
+  if (a.from_frame != b.from_frame) return a.from_frame < b.from_frame;
+  return a.to_frame < b.to_frame;
+}
+
+//one piece per ordered pair of motions: piece = from * count + to. Only
+//the motions of the pairs being worked on are kept loaded.
+class PairJob : public ParallelJob
+{
+public:
+  PairJob(unsigned int count, MotionGraph::Options const &_options)
+  : options(_options), found(count * count),
+    done(0), pruned(0), cells(0), last_report(0)
+  {
+    //what pruning needs from each motion, loading one at a time:
+    bounds.resize(count);
+    for (unsigned int m = 0; m < count; ++m)
+    {
+      Motion const &motion = pin(m);
+      motions.push_back(&motion);
+      frames.push_back(motion.frames());
+      usable.push_back(motion.frames() >= options.window && !motion.joint_positions.empty());
+      if (usable[m]) bounds[m].compute(motion);
+      unpin(motion);
+    }
+    lock = SDL_CreateMutex();
+    assert(lock);
+    start = last_report = SDL_GetTicks();
+  }
+  virtual ~PairJob()
+  {
+    SDL_DestroyMutex(lock);
+  }
+
+  virtual void run(unsigned int piece)
+  {
+    unsigned int from = piece / motions.size();
+    unsigned int to = piece % motions.size();
+    unsigned int pair_cells = 0;
+    if (worth_trying(from, to))
+    {
+      pin(*motions[from]);
+      pin(*motions[to]);
+      DistanceMap map(motions[from], motions[to]);
+      vector< DistanceMap::Transition > transitions;
+      //the pairs are already spread over the threads:
+      map.findTransitions(options.window, options.per_pair, transitions, 1);
+      for (unsigned int t = 0; t < transitions.size(); ++t)
+      {
+        if (options.max_cost > 0.0f && transitions[t].cost > options.max_cost) break;
+        MotionGraph::Edge edge;
+        edge.to_motion = to;
+        edge.from_frame = transitions[t].from_frame;
+        edge.to_frame = transitions[t].to_frame;
+        edge.cost = transitions[t].cost;
+        found[piece].push_back(edge);
+      }
+      unpin(*motions[from]);
+      unpin(*motions[to]);
+      pair_cells = frames[from] * frames[to];
+    }
+    finished(pair_cells);
+  }
+
+  void summary()
+  {
+    if (!options.report) return;
+    float seconds = (SDL_GetTicks() - start) / 1000.0f;
+    cout << "Built motion graph: " << done << " pairs (" << pruned << " skipped) in " << seconds << " seconds";
+    if (seconds > 0.0f)
+    {
+      cout << ", " << done / seconds << " pairs/s, " << cells / seconds * 1e-6 << " M distances/s";
+    }
+    cout << "." << endl;
+  }
+
+  vector< Motion const * > motions;
+  MotionGraph::Options const &options;
+  vector< vector< MotionGraph::Edge > > found;
+
+private:
+  bool worth_trying(unsigned int from, unsigned int to) const
+  {
+    if (!usable[from] || !usable[to]) return false;
+    if (motions[from]->joint_stride() != motions[to]->joint_stride()) return false;
+    if (motions[from]->skeleton->bones.size() != motions[to]->skeleton->bones.size()) return false;
+    //every frame in a window costs at least the bound:
+    if (options.max_cost > 0.0f
+        && options.window * bounds[from].distance_bound(bounds[to]) > options.max_cost) return false;
+    return true;
+  }
+
+  void finished(unsigned int pair_cells)
+  {
+    SDL_LockMutex(lock);
+    ++done;
+    if (pair_cells == 0) ++pruned;
+    cells += pair_cells;
+    unsigned int now = SDL_GetTicks();
+    if (options.report && now - last_report >= 1000)
+    {
+      last_report = now;
+      float seconds = (now - start) / 1000.0f;
+      cout << "  " << done << " / " << found.size() << " pairs (" << pruned << " skipped), "
+           << done / seconds << " pairs/s, " << cells / seconds * 1e-6 << " M distances/s" << endl;
+    }
+    SDL_UnlockMutex(lock);
+  }
+
+  vector< unsigned int > frames;
+  vector< char > usable; //long enough for the window, with joint positions
+  vector< JointBounds > bounds;
+  SDL_mutex *lock;
+  unsigned int done;
+  unsigned int pruned;
+  double cells;
+  unsigned int start;
+  unsigned int last_report;
+};
+
+}
+
+MotionGraph::Options::Options() : window(30), per_pair(4), max_cost(0.0f), threads(0), report(true)
+{
+}
+
+MotionGraph::MotionGraph() : window(0), signature(0)
+{
+  first_edge.push_back(0);
+}
+
+void MotionGraph::build(Options const &options)
+{
+  unsigned int count = motion_count();
+  window = options.window;
+  signature = Library::signature;
+
+  if (options.report)
+  {
+    cout << "Building motion graph over " << count * count << " pairs of motions." << endl;
+  }
+
+  PairJob job(count, options);
+  parallel_for(job, job.found.size(), options.threads);
+  job.summary();
+
+  vector< Motion const * > const &library = job.motions;
+  filenames.clear();
+  for (unsigned int m = 0; m < library.size(); ++m)
+  {
+    filenames.push_back(library[m]->filename);
+  }
+
+  edges.clear();
+  first_edge.clear();
+  first_edge.push_back(0);
+  for (unsigned int from = 0; from < library.size(); ++from)
+  {
+    for (unsigned int to = 0; to < library.size(); ++to)
+    {
+      vector< Edge > const &pair = job.found[from * library.size() + to];
+      edges.insert(edges.end(), pair.begin(), pair.end());
+    }
+    std::sort(edges.begin() + first_edge.back(), edges.end(), cheaper_edge);
+    first_edge.push_back(edges.size());
+  }
+}
+
+unsigned int MotionGraph::motions() const
+{
+  return first_edge.size() - 1;
+}
+
+unsigned int MotionGraph::edge_count(unsigned int from) const
+{
+  assert(from < motions());
+  return first_edge[from + 1] - first_edge[from];
+}
+
+MotionGraph::Edge const &MotionGraph::edge(unsigned int from, unsigned int index) const
+{
+  assert(index < edge_count(from));
+  return edges[first_edge[from] + index];
+}
+
+MotionGraph::Edge const *MotionGraph::best_edge(unsigned int from, unsigned int frame) const
+{
+  assert(from < motions());
+  for (unsigned int e = first_edge[from]; e < first_edge[from + 1]; ++e)
+  {
+    if (edges[e].from_frame >= frame) return &edges[e];
+  }
+  return NULL;
+}
+
+//file: magic, version, signature, window, motion count, edge count; then
+//for each motion its filename length and filename; then first_edge
+//(motion count + 1 entries) and the edges themselves.
+bool MotionGraph::save(string const &filename) const
+{
+  ofstream out(filename.c_str(), ios::out | ios::binary);
+  if (!out) return false;
+  unsigned int header[5] = {GraphVersion, signature, window, motions(), (unsigned int)edges.size()};
+  out.write(GraphMagic, sizeof(GraphMagic));
+  out.write((char const *)header, sizeof(header));
+  for (unsigned int m = 0; m < filenames.size(); ++m)
+  {
+    unsigned int length = filenames[m].size();
+    out.write((char const *)&length, sizeof(length));
+    out.write(filenames[m].data(), length);
+  }
+  out.write((char const *)&first_edge[0], first_edge.size() * sizeof(unsigned int));
+  if (!edges.empty())
+  {
+    out.write((char const *)&edges[0], edges.size() * sizeof(Edge));
+  }
+  return (bool)out;
+}
+
+bool MotionGraph::load(string const &filename)
+{
+  ifstream in(filename.c_str(), ios::in | ios::binary);
+  if (!in) return false;
+  char magic[4];
+  unsigned int header[5];
+  in.read(magic, sizeof(magic));
+  in.read((char *)header, sizeof(header));
+  if (!in || memcmp(magic, GraphMagic, sizeof(magic)) != 0 || header[0] != GraphVersion)
+  {
+    cerr << "'" << filename << "' isn't a motion graph." << endl;
+    return false;
+  }
+  if (header[1] != Library::signature || header[3] != motion_count())
+  {
+    cerr << "Motion graph '" << filename << "' was built from different motions." << endl;
+    return false;
+  }
+
+  vector< string > file_names(header[3]);
+  for (unsigned int m = 0; m < file_names.size(); ++m)
+  {
+    unsigned int length = 0;
+    in.read((char *)&length, sizeof(length));
+    if (!in) return false;
+    file_names[m].resize(length);
+    if (length) in.read(&file_names[m][0], length);
+    if (base_name(file_names[m]) != base_name(motion(m).filename))
+    {
+      cerr << "Motion graph '" << filename << "' was built from different motions." << endl;
+      return false;
+    }
+  }
+  vector< unsigned int > file_first_edge(header[3] + 1);
+  in.read((char *)&file_first_edge[0], file_first_edge.size() * sizeof(unsigned int));
+  vector< Edge > file_edges(header[4]);
+  if (!file_edges.empty())
+  {
+    in.read((char *)&file_edges[0], file_edges.size() * sizeof(Edge));
+  }
+  if (!in || file_first_edge.back() != file_edges.size())
+  {
+    cerr << "Motion graph '" << filename << "' is truncated." << endl;
+    return false;
+  }
+
+  signature = header[1];
+  window = header[2];
+  filenames.swap(file_names);
+  first_edge.swap(file_first_edge);
+  edges.swap(file_edges);
+  return true;
+}
+
+} //namespace Library
@@ -0,0 +1,77 @@
+#ifndef MOTIONGRAPH_HPP
+#define MOTIONGRAPH_HPP
+
+#include "Library.hpp"
+
+#include <vector>
+#include <string>
+
+namespace Library
+{
+
+//A transition graph over the whole library: for every ordered pair of
+//motions, the cheapest places to blend from one into the other (as found
+//by DistanceMap::findTransitions). Build it once with a batch tool, save
+//it, and the runtime can load it and pick any next clip without working
+//out a single distance.
+class MotionGraph
+{
+public:
+  //blend from motion index 'from' (whichever motion's edges these are)
+  //frames from_frame.. into motion index to_motion frames to_frame..
+  class Edge
+  {
+  public:
+    unsigned int to_motion;
+    unsigned int from_frame;
+    unsigned int to_frame;
+    float cost; //summed distance over the blend window
+  };
+
+  class Options
+  {
+  public:
+    Options();
+    unsigned int window; //frames in each blend
+    unsigned int per_pair; //keep at most this many edges per pair
+    float max_cost; //drop edges costing more than this (0 -> keep all)
+    unsigned int threads; //0 -> one per processor
+    bool report; //print progress to cout
+  };
+
+  MotionGraph();
+
+  //build from every ordered pair of motions in the library. Pairs that
+  //can't have an edge cheaper than max_cost, because their joint positions
+  //never come near each other, are skipped without computing their
+  //distance maps; so are pairs with different skeletons. Only the pairs
+  //being worked on are kept loaded, so under a memory_budget this needs
+  //room for about two motions per thread.
+  void build(Options const &options = Options());
+
+  unsigned int motions() const;
+  //edges leaving motion 'from', cheapest first:
+  unsigned int edge_count(unsigned int from) const;
+  Edge const &edge(unsigned int from, unsigned int index) const;
+  //cheapest edge leaving 'from' at or after from frame 'frame' (NULL if
+  //there isn't one):
+  Edge const *best_edge(unsigned int from, unsigned int frame) const;
+
+  bool save(string const &filename) const;
+  //fails (returning false) unless the file was built from the library
+  //as it is now loaded, so motion indices line up.
+  bool load(string const &filename);
+
+  unsigned int window;
+  unsigned int signature; //Library::signature when built
+
+private:
+  std::vector< string > filenames;
+  //edges leaving motion m are edges[first_edge[m]] up to edges[first_edge[m+1]]
+  std::vector< unsigned int > first_edge;
+  std::vector< Edge > edges;
+};
+
+} //namespace Library
+
+#endif //MOTIONGRAPH_HPP
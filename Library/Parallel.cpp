@@ -0,0 +1,99 @@
+#include "Parallel.hpp"
+
+#include <SDL_thread.h>
+
+#include <vector>
+#include <assert.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using std::vector;
+
+namespace Library
+{
+
+namespace
+{
+
+class PieceQueue
+{
+public:
+  ParallelJob *job;
+  unsigned int count;
+  unsigned int next;
+  SDL_mutex *lock;
+};
+
+int worker_main(void *data)
+{
+  PieceQueue &queue = *(PieceQueue *)data;
+  while (1)
+  {
+    SDL_LockMutex(queue.lock);
+    unsigned int piece = queue.next;
+    if (piece < queue.count) ++queue.next;
+    SDL_UnlockMutex(queue.lock);
+    if (piece >= queue.count) break;
+    queue.job->run(piece);
+  }
+  return 0;
+}
+
+}
+
+unsigned int processor_count()
+{
+#ifdef WINDOWS
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  long count = info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (count < 1) count = 1;
+  return (unsigned int)count;
+}
+
+void parallel_for(ParallelJob &job, unsigned int count, unsigned int threads)
+{
+  if (threads == 0) threads = processor_count();
+  if (threads > count) threads = count;
+
+  //not worth starting any threads:
+  if (threads <= 1)
+  {
+    for (unsigned int p = 0; p < count; ++p)
+    {
+      job.run(p);
+    }
+    return;
+  }
+
+  PieceQueue queue;
+  queue.job = &job;
+  queue.count = count;
+  queue.next = 0;
+  queue.lock = SDL_CreateMutex();
+  assert(queue.lock);
+
+  vector< SDL_Thread * > workers;
+  for (unsigned int t = 1; t < threads; ++t)
+  {
+    SDL_Thread *worker = SDL_CreateThread(worker_main, &queue);
+    if (worker) workers.push_back(worker);
+  }
+  //this thread pitches in too (and does everything if threads couldn't start).
+  worker_main(&queue);
+  for (unsigned int t = 0; t < workers.size(); ++t)
+  {
+    SDL_WaitThread(workers[t], NULL);
+  }
+
+  SDL_DestroyMutex(queue.lock);
+}
+
+} //namespace Library
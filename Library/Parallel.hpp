@@ -0,0 +1,30 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+namespace Library
+{
+
+//A job that can be split into independent, numbered pieces.
+class ParallelJob
+{
+public:
+  virtual ~ParallelJob()
+  {
+  }
+  //do piece number 'piece'. May be called from any thread, so pieces
+  //mustn't write to anything another piece touches.
+  virtual void run(unsigned int piece) = 0;
+};
+
+//number of processors available (at least 1).
+unsigned int processor_count();
+
+//calls job.run(p) for every p in [0, count), spread over 'threads' threads
+//(0 -> one per processor). The calling thread does work too, and this
+//returns once every piece is done. Pieces are handed out in increasing
+//order, but may finish in any order.
+void parallel_for(ParallelJob &job, unsigned int count, unsigned int threads = 0);
+
+} //namespace Library
+
+#endif //PARALLEL_HPP
@@ -0,0 +1,58 @@
+#include "Library/PoseCache.hpp"
+
+#include <cassert>
+#include <algorithm>
+
+using namespace Character;
+
+namespace Library
+{
+
+PoseCache::PoseCache(unsigned int n_slots)
+: slots(n_slots),
+  clock(0)
+{
+  assert(n_slots > 0);
+  clear();
+}
+
+const Pose& PoseCache::get(const Motion *motion, unsigned int frame)
+{
+  ++clock;
+
+  // Few enough slots that looking through them all is quickest
+  Slot *oldest = &(slots[0]);
+  for(unsigned int i = 0; i < slots.size(); ++i)
+  {
+    if(slots[i].motion == motion && slots[i].frame == frame)
+    {
+      slots[i].last_used = clock;
+      return slots[i].pose;
+    }
+    if(slots[i].last_used < oldest->last_used) oldest = &(slots[i]);
+  }
+
+  oldest->motion = motion;
+  oldest->frame = frame;
+  oldest->last_used = clock;
+  motion->get_pose(frame, oldest->pose);
+  return oldest->pose;
+}
+
+void PoseCache::clear()
+{
+  for(unsigned int i = 0; i < slots.size(); ++i)
+  {
+    slots[i].motion = NULL;
+    slots[i].last_used = 0;
+  }
+  clock = 0;
+}
+
+void PoseCache::swap(PoseCache &other)
+{
+  slots.swap(other.slots);
+  std::swap(clock, other.clock);
+}
+
+}
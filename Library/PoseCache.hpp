@@ -0,0 +1,48 @@
+#ifndef __POSECACHE_H__
+#define __POSECACHE_H__
+
+#include <Library/Library.hpp>
+#include <Character/Character.hpp>
+
+#include <vector>
+
+namespace Library
+{
+
+/* Keeps the last few poses decoded from motions, so a frame that's asked
+ * for again (LerpBlender asks for each frame pair twice: once as the
+ * current pair, then as the last pair) isn't decoded again.  The poses are
+ * reused in place, so once the slots have been filled, getting a pose
+ * doesn't allocate anything. */
+class PoseCache
+{
+public:
+  PoseCache(unsigned int n_slots = 4);
+
+  /* The pose for a frame of a motion, decoded if it isn't here already.
+   * The reference stays good until n_slots more different poses have been
+   * asked for. */
+  const Character::Pose& get(const Motion *motion, unsigned int frame);
+
+  /* Forget everything (the slots keep their memory) */
+  void clear();
+
+  /* Exchanges two caches without copying any poses */
+  void swap(PoseCache &other);
+
+private:
+  struct Slot
+  {
+    const Motion *motion;
+    unsigned int frame;
+    unsigned int last_used;
+    Character::Pose pose;
+  };
+
+  std::vector<Slot> slots;
+  unsigned int clock;
+};
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include "Library/Prefetcher.hpp"
+
+#include <SDL_thread.h>
+
+#include <cassert>
+
+namespace Library
+{
+
+Prefetcher::Prefetcher(unsigned int d, unsigned int thread_count)
+: depth(d),
+  quitting(false),
+  generation(0)
+{
+  lock = SDL_CreateMutex();
+  work = SDL_CreateCond();
+  assert(lock != NULL);
+  assert(work != NULL);
+
+  if(thread_count == 0) thread_count = 1;
+  for(unsigned int t = 0; t < thread_count; ++t)
+  {
+    SDL_Thread *thread = SDL_CreateThread(workerMain, this);
+    if(thread != NULL) threads.push_back(thread);
+  }
+}
+
+Prefetcher::~Prefetcher()
+{
+  SDL_LockMutex(lock);
+  quitting = true;
+  queued.clear();
+  SDL_CondBroadcast(work);
+  SDL_UnlockMutex(lock);
+
+  for(unsigned int t = 0; t < threads.size(); ++t)
+  {
+    SDL_WaitThread(threads[t], NULL);
+  }
+
+  for(unsigned int i = 0; i < held.size(); ++i) unpin(*held[i].second);
+  SDL_DestroyCond(work);
+  SDL_DestroyMutex(lock);
+}
+
+void Prefetcher::start(const std::vector<unsigned int> &upcoming)
+{
+  unsigned int count = motion_count();
+  std::vector<unsigned int> wanted;
+  for(unsigned int u = 0; u < upcoming.size() && wanted.size() < depth; ++u)
+  {
+    /* The same motion can come up more than once along the way */
+    bool listed = false;
+    for(unsigned int w = 0; w < wanted.size(); ++w)
+    {
+      if(wanted[w] == upcoming[u]) listed = true;
+    }
+    if(!listed && upcoming[u] < count) wanted.push_back(upcoming[u]);
+  }
+
+  std::vector<std::pair<unsigned int, const Motion *> > keep, release;
+
+  SDL_LockMutex(lock);
+  ++generation;
+  queued.clear();
+
+  /* Motions loaded for the last start() that are still wanted keep their
+   * pins; the rest are let go */
+  for(unsigned int i = 0; i < held.size(); ++i)
+  {
+    bool still_wanted = false;
+    for(unsigned int w = 0; w < wanted.size(); ++w)
+    {
+      if(wanted[w] == held[i].first) still_wanted = true;
+    }
+    if(still_wanted) keep.push_back(held[i]);
+    else release.push_back(held[i]);
+  }
+  for(unsigned int w = 0; w < wanted.size(); ++w)
+  {
+    bool have = false;
+    for(unsigned int i = 0; i < keep.size(); ++i)
+    {
+      if(keep[i].first == wanted[w]) have = true;
+    }
+    if(!have) queued.push_back(wanted[w]);
+  }
+  held.swap(keep);
+
+  SDL_CondBroadcast(work);
+  SDL_UnlockMutex(lock);
+
+  for(unsigned int i = 0; i < release.size(); ++i) unpin(*release[i].second);
+}
+
+void Prefetcher::cancel()
+{
+  std::vector<std::pair<unsigned int, const Motion *> > release;
+
+  SDL_LockMutex(lock);
+  ++generation;
+  queued.clear();
+  held.swap(release);
+  SDL_UnlockMutex(lock);
+
+  for(unsigned int i = 0; i < release.size(); ++i) unpin(*release[i].second);
+}
+
+int Prefetcher::workerMain(void *data)
+{
+  Prefetcher &self = *(Prefetcher *) data;
+
+  SDL_LockMutex(self.lock);
+  while(true)
+  {
+    while(!self.quitting && self.queued.empty())
+    {
+      SDL_CondWait(self.work, self.lock);
+    }
+    if(self.quitting) break;
+
+    unsigned int index = self.queued.front();
+    self.queued.pop_front();
+    unsigned int asked = self.generation;
+    SDL_UnlockMutex(self.lock);
+
+    // The slow part, with nothing of ours locked
+    const Motion &motion = pin(index);
+
+    SDL_LockMutex(self.lock);
+    if(asked == self.generation && !self.quitting)
+    {
+      self.held.push_back(std::make_pair(index, &motion));
+    }
+    else
+    {
+      // Asked for something else since; don't keep it pinned
+      SDL_UnlockMutex(self.lock);
+      unpin(motion);
+      SDL_LockMutex(self.lock);
+    }
+  }
+  SDL_UnlockMutex(self.lock);
+
+  return 0;
+}
+
+}
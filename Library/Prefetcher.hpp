@@ -0,0 +1,66 @@
+#ifndef __PREFETCHER_H__
+#define __PREFETCHER_H__
+
+#include <Library/Library.hpp>
+
+#include <vector>
+#include <deque>
+#include <utility>
+
+struct SDL_Thread;
+struct SDL_mutex;
+struct SDL_cond;
+
+namespace Library
+{
+
+/* Loads the motions that will play next on background threads, so that
+ * with lazy loading the parsing and the control and joint data for a clip
+ * are ready before it's needed.  Motions it has loaded stay pinned until
+ * the next call to start() or cancel(), so the library can't unload them
+ * to make room for each other. */
+class Prefetcher
+{
+public:
+  /* Looks 'depth' motions ahead, loading them on 'threads' threads */
+  Prefetcher(unsigned int depth = 2, unsigned int threads = 1);
+
+  /* Drops anything not yet started and waits for loads under way */
+  ~Prefetcher();
+
+  /* Starts loading the first 'depth' of the motions in 'upcoming' (motion
+   * indices in the order they'll play, soonest first), dropping whatever
+   * was asked for before.  Returns straight away. */
+  void start(const std::vector<unsigned int> &upcoming);
+
+  /* Drops everything asked for and unpins what was loaded.  Loads already
+   * under way finish, but their motions aren't kept pinned. */
+  void cancel();
+
+  /* A new depth takes effect at the next start() */
+  unsigned int getDepth() const { return depth; }
+  void setDepth(unsigned int d) { depth = d; }
+
+private:
+  Prefetcher(const Prefetcher &);
+  Prefetcher& operator= (const Prefetcher &);
+
+  static int workerMain(void *data);
+
+  unsigned int depth;
+  std::vector<SDL_Thread *> threads;
+
+  /* Everything below is guarded by lock */
+  SDL_mutex *lock;
+  SDL_cond *work;               // signalled when there's more to load
+
+  bool quitting;                // the workers should stop
+  unsigned int generation;      // bumped by every start() and cancel()
+  std::deque<unsigned int> queued; // motion indices, nearest first
+  std::vector<std::pair<unsigned int, const Motion *> > held; // pinned for
+                                // this generation, with their indices
+};
+
+}
+
+#endif
@@ -4,11 +4,15 @@
 #include <cctype>
 #include <algorithm>
 #include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include <arpa/inet.h>
 
 #include "ReadSkeleton.hpp"
 
 #include "Reader.hpp"
+#include "FileView.hpp"
 
 using namespace Library;
 using std::ifstream;
@@ -17,6 +21,7 @@ using std::endl;
 using std::set;
 using std::transform;
 using std::getline;
+using Library::FileView;
 
 Reader::Reader< Skeleton > &get_reader();
 
@@ -45,9 +50,50 @@ bool ReadSkeleton(string filename, Skeleton &into)
   return ret && into.check_parse();
 }
 
-bool ReadAnimationBin(string filename, Skeleton const &skeleton, vector< double > &positions)
+namespace
 {
-  ifstream file(filename.c_str());
+
+//names and dof counts of every bone, as both versions of the bmc
+//'skel' chunk hold them (dof counts in network order). False if the
+//skeleton's frame offsets aren't in bone order, which bmc assumes.
+bool skeleton_chunk(Skeleton const &skeleton, vector< char > &expected)
+{
+  expected.clear();
+  expected.push_back('r');
+  expected.push_back('o');
+  expected.push_back('o');
+  expected.push_back('t');
+  expected.push_back('\0');
+  unsigned int net_six = htonl(6);
+  expected.push_back(((char *)(&net_six))[0]);
+  expected.push_back(((char *)(&net_six))[1]);
+  expected.push_back(((char *)(&net_six))[2]);
+  expected.push_back(((char *)(&net_six))[3]);
+  int ofs = 6;
+  for (unsigned int b = 0; b < skeleton.bones.size(); ++b)
+  {
+    for (unsigned int i = 0; i < skeleton.bones[b].name.size(); ++i)
+    {
+      expected.push_back(skeleton.bones[b].name[i]);
+    }
+    expected.push_back('\0');
+    unsigned int net_dof = htonl(skeleton.bones[b].dof.size());
+    expected.push_back(((char *)(&net_dof))[0]);
+    expected.push_back(((char *)(&net_dof))[1]);
+    expected.push_back(((char *)(&net_dof))[2]);
+    expected.push_back(((char *)(&net_dof))[3]);
+    if (skeleton.bones[b].frame_offset != ofs)
+    {
+      return false;
+    }
+    ofs += skeleton.bones[b].dof.size();
+  }
+  return true;
+}
+
+bool read_animation_bin_v1(string filename, Skeleton const &skeleton, vector< double > &positions)
+{
+  ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
   {
     //check magic number.
     char magic[4];
@@ -90,35 +136,10 @@ bool ReadAnimationBin(string filename, Skeleton const &skeleton, vector< double
       return false;
     }
     vector< char > expected;
-    expected.push_back('r');
-    expected.push_back('o');
-    expected.push_back('o');
-    expected.push_back('t');
-    expected.push_back('\0');
-    unsigned int net_six = htonl(6);
-    expected.push_back(((char *)(&net_six))[0]);
-    expected.push_back(((char *)(&net_six))[1]);
-    expected.push_back(((char *)(&net_six))[2]);
-    expected.push_back(((char *)(&net_six))[3]);
-    int ofs = 6;
-    for (unsigned int b = 0; b < skeleton.bones.size(); ++b)
-    {
-      for (unsigned int i = 0; i < skeleton.bones[b].name.size(); ++i)
-      {
-        expected.push_back(skeleton.bones[b].name[i]);
-      }
-      expected.push_back('\0');
-      unsigned int net_dof = htonl(skeleton.bones[b].dof.size());
-      expected.push_back(((char *)(&net_dof))[0]);
-      expected.push_back(((char *)(&net_dof))[1]);
-      expected.push_back(((char *)(&net_dof))[2]);
-      expected.push_back(((char *)(&net_dof))[3]);
-      if (skeleton.bones[b].frame_offset != ofs)
-      {
-        cerr << "Frame offsets not in order. This reader will be incompatible!" << endl;
-        return false;
-      }
-      ofs += skeleton.bones[b].dof.size();
+    if (!skeleton_chunk(skeleton, expected))
+    {
+      cerr << "Frame offsets not in order. This reader will be incompatible!" << endl;
+      return false;
     }
     if (expected.size() + 8 != size)
     {
@@ -216,6 +237,310 @@ bool ReadAnimationBin(string filename, Skeleton const &skeleton, vector< double
   return true;
 }
 
+//bmc version 2: one header, the skeleton chunk, then every frame back to
+//back, so loading is a single copy out of the mapped file. Frames hold
+//exactly what ReadAnimation puts in 'positions' (lengths scaled, angles
+//in degrees), so the header records the skeleton settings that scaling
+//depended on. Everything is in this machine's byte order; byte_order
+//catches a file written elsewhere.
+char const BinMagic[4] = {'b', 'm', 'c', '2'};
+unsigned int const BinByteOrder = 0x01020304;
+//frame data starts on a multiple of this (from the start of the file):
+unsigned int const BinAlignment = 64;
+
+class BinHeader
+{
+public:
+  char magic[4];
+  unsigned int byte_order;
+  unsigned int frames;
+  unsigned int frame_size;
+  unsigned int skeleton_size; //bytes of skeleton chunk after the header
+  unsigned int data_offset; //where frame data starts
+  unsigned int ang_is_deg;
+  unsigned int unused;
+  double length; //skeleton length
+};
+
+bool read_animation_bin_v2(string filename, char const *bytes, size_t size, Skeleton const &skeleton, vector< double > &positions)
+{
+  BinHeader header;
+  if (size < sizeof(header))
+  {
+    cerr << "Truncated header in bmc '" << filename << "'." << endl;
+    return false;
+  }
+  memcpy(&header, bytes, sizeof(header));
+  if (header.byte_order != BinByteOrder)
+  {
+    cerr << "bmc '" << filename << "' was written with a different byte order." << endl;
+    return false;
+  }
+  if ((int)header.frame_size != skeleton.frame_size
+      || header.length != skeleton.length
+      || (header.ang_is_deg != 0) != skeleton.ang_is_deg)
+  {
+    cerr << "bmc '" << filename << "' was written for a different skeleton." << endl;
+    return false;
+  }
+  vector< char > expected;
+  if (!skeleton_chunk(skeleton, expected))
+  {
+    cerr << "Frame offsets not in order. This reader will be incompatible!" << endl;
+    return false;
+  }
+  if (header.skeleton_size != expected.size()
+      || size < sizeof(header) + expected.size()
+      || memcmp(bytes + sizeof(header), &expected[0], expected.size()) != 0)
+  {
+    cerr << "Expected skeleton chunk does not match in bmc '" << filename << "'." << endl;
+    return false;
+  }
+  size_t count = (size_t)header.frames * header.frame_size;
+  if (header.data_offset < sizeof(header) + expected.size()
+      || header.data_offset > size
+      || (size - header.data_offset) / sizeof(double) < count)
+  {
+    cerr << "Truncated frame data in bmc '" << filename << "'." << endl;
+    return false;
+  }
+  if (size - header.data_offset != count * sizeof(double))
+  {
+    cerr << "WARNING: trailing data in bmc. Maybe frame count was wrong?" << endl;
+  }
+  positions.resize(count);
+  if (count)
+  {
+    memcpy(&positions[0], bytes + header.data_offset, count * sizeof(double));
+  }
+  return true;
+}
+
+}
+
+bool ReadAnimationBin(string filename, Skeleton const &skeleton, vector< double > &positions)
+{
+  FileView file(filename);
+  if (!file.opened())
+  {
+    return false;
+  }
+  if (file.size() >= sizeof(BinMagic) && memcmp(file.data(), BinMagic, sizeof(BinMagic)) == 0)
+  {
+    return read_animation_bin_v2(filename, file.data(), file.size(), skeleton, positions);
+  }
+  return read_animation_bin_v1(filename, skeleton, positions);
+}
+
+bool WriteAnimationBin(string filename, Skeleton const &skeleton, vector< double > const &positions)
+{
+  if (skeleton.frame_size <= 0 || positions.size() % skeleton.frame_size != 0)
+  {
+    return false;
+  }
+  vector< char > chunk;
+  if (!skeleton_chunk(skeleton, chunk))
+  {
+    cerr << "Frame offsets not in order. This writer will be incompatible!" << endl;
+    return false;
+  }
+  BinHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BinMagic, sizeof(BinMagic));
+  header.byte_order = BinByteOrder;
+  header.frames = positions.size() / skeleton.frame_size;
+  header.frame_size = skeleton.frame_size;
+  header.skeleton_size = chunk.size();
+  header.data_offset = (sizeof(header) + chunk.size() + BinAlignment - 1) / BinAlignment * BinAlignment;
+  header.ang_is_deg = skeleton.ang_is_deg ? 1 : 0;
+  header.length = skeleton.length;
+
+  std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!file)
+  {
+    return false;
+  }
+  file.write((char const *)&header, sizeof(header));
+  file.write(&chunk[0], chunk.size());
+  vector< char > padding(header.data_offset - sizeof(header) - chunk.size(), '\0');
+  if (!padding.empty())
+  {
+    file.write(&padding[0], padding.size());
+  }
+  if (!positions.empty())
+  {
+    file.write((char const *)&positions[0], positions.size() * sizeof(double));
+  }
+  file.close();
+  return (bool)file;
+}
+
+namespace
+{
+
+//AMC text, read straight out of the file a line at a time; tokens and
+//numbers come off each line just as 'istringstream >>' would take them.
+class AmcScanner
+{
+public:
+  AmcScanner(char const *data, size_t size) : next(data), end(data + size), at(data), line_end(data)
+  {
+  }
+
+  //move on to the next line (less any comment); false once there are none.
+  bool next_line()
+  {
+    if (next == end) return false;
+    at = next;
+    char const *newline = (char const *)memchr(next, '\n', end - next);
+    line_end = (newline ? newline : end);
+    next = (newline ? newline + 1 : end);
+    char const *comment = (char const *)memchr(at, '#', line_end - at);
+    if (comment) line_end = comment;
+    return true;
+  }
+
+  //next whitespace-separated token on the line:
+  bool token(char const *&begin, size_t &length)
+  {
+    skip_space();
+    if (at == line_end) return false;
+    begin = at;
+    while (at != line_end && !is_space(*at)) ++at;
+    length = at - begin;
+    return true;
+  }
+
+  //next number on the line:
+  bool number(double &value);
+
+  //whether 'istringstream >> int' would get a number out of the token:
+  static bool is_integer(char const *begin, size_t length)
+  {
+    if (length && (*begin == '+' || *begin == '-'))
+    {
+      ++begin;
+      --length;
+    }
+    return length && *begin >= '0' && *begin <= '9';
+  }
+
+private:
+  static bool is_space(char c)
+  {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+  void skip_space()
+  {
+    while (at != line_end && is_space(*at)) ++at;
+  }
+
+  char const *next;
+  char const *end;
+  char const *at;
+  char const *line_end;
+};
+
+//powers of ten that doubles hold exactly:
+double const exact_powers[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool AmcScanner::number(double &value)
+{
+  skip_space();
+  //take the characters num_get would -- a sign, digits with at most one
+  //point, then an exponent if there were any digits -- and work out the
+  //value as we go:
+  char const *begin = at;
+  char const *p = at;
+  bool negative = false;
+  if (p != line_end && (*p == '+' || *p == '-'))
+  {
+    negative = (*p == '-');
+    ++p;
+  }
+  unsigned long long mantissa = 0;
+  unsigned int digits = 0;
+  int exponent = 0;
+  bool any_digits = false;
+  bool point = false;
+  bool exact = true;
+  for (; p != line_end; ++p)
+  {
+    if (*p >= '0' && *p <= '9')
+    {
+      any_digits = true;
+      if (mantissa == 0 && *p == '0')
+      {
+        if (point) --exponent;
+      }
+      else if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        ++digits;
+        if (point) --exponent;
+      }
+      else
+      {
+        exact = false;
+      }
+    }
+    else if (*p == '.' && !point)
+    {
+      point = true;
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (!any_digits) return false;
+  if (p != line_end && (*p == 'e' || *p == 'E'))
+  {
+    ++p;
+    bool exponent_negative = false;
+    if (p != line_end && (*p == '+' || *p == '-'))
+    {
+      exponent_negative = (*p == '-');
+      ++p;
+    }
+    int e = 0;
+    bool exponent_digits = false;
+    for (; p != line_end && *p >= '0' && *p <= '9'; ++p)
+    {
+      if (e < 100000) e = e * 10 + (*p - '0');
+      exponent_digits = true;
+    }
+    if (!exponent_digits) return false; //("1e" doesn't parse either)
+    exponent += (exponent_negative ? -e : e);
+  }
+  at = p;
+
+  //one correctly rounded multiply or divide of two exact values gives
+  //the same double strtod would:
+  if (exact && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+  {
+    value = (double)mantissa;
+    if (exponent < 0) value /= exact_powers[-exponent];
+    else value *= exact_powers[exponent];
+    if (negative) value = -value;
+    return true;
+  }
+  //otherwise, let strtod do it (which is all num_get does):
+  string text(begin, p);
+  char *text_end = NULL;
+  value = strtod(text.c_str(), &text_end);
+  if (text_end != text.c_str() + text.size() || value == HUGE_VAL || value == -HUGE_VAL)
+  {
+    return false;
+  }
+  return true;
+}
+
+}
+
 bool ReadAnimation(string filename, Skeleton const &on, vector< double > &positions)
 {
   // quick hack to load .v's
@@ -228,10 +553,11 @@ bool ReadAnimation(string filename, Skeleton const &on, vector< double > &positi
     return false;
 #endif
   }
-  if (filename.size() >= 4 && (filename.substr(filename.size()-4,4)==".amc"))
+  if (filename.size() >= 4 && (filename.substr(filename.size()-4,4)==".amc"
+                                || filename.substr(filename.size()-4,4)==".AMC"))
   {
-    string temp = filename;
-    temp[temp.size()-3] = 'b';
+    //(amc2bmc writes x.bmc for x.amc and x.AMC alike)
+    string temp = filename.substr(0, filename.size()-4) + ".bmc";
     if (ReadAnimationBin(temp, on, positions))
     {
       cerr << "Using .bmc version of '" << filename << "'" << endl;
@@ -242,8 +568,11 @@ bool ReadAnimation(string filename, Skeleton const &on, vector< double > &positi
   {
     return ReadAnimationBin(filename, on, positions);
   }
+  return ReadAnimationAmc(filename, on, positions);
+}
 
-
+bool ReadAnimationAmc(string filename, Skeleton const &on, vector< double > &positions)
+{
   map< string, int > bone_map;
   for (unsigned int b = 0; b < on.bones.size(); ++b)
   {
@@ -254,116 +583,131 @@ bool ReadAnimation(string filename, Skeleton const &on, vector< double > &positi
   positions.clear();
 
   //suddenly, Jim gets bored of using 'Reader'.
-  ifstream file(filename.c_str());
-  if (!file)
+  FileView file(filename);
+  if (!file.opened())
   {
     return false;
   }
-  string line_in;
+  AmcScanner scan(file.data(), file.size());
   int current_frame = -1;
   int dof_read = 0;
-  while (getline(file, line_in))
+  //bones in the order the last frame listed them; frames almost always
+  //list them the same way, so each name is usually one compare away:
+  vector< int > frame_order;
+  unsigned int slot = 0;
+  char const *tok;
+  size_t tok_length;
+  while (scan.next_line())
   {
-    string tline = "";
-    for (unsigned int i = 0; i < line_in.size(); ++i)
+    if (!scan.token(tok, tok_length) || tok[0] == ':')
     {
-      if (line_in[i] == '#') break;
-      tline += line_in[i];
+      continue;
     }
-    istringstream line(tline);
-    string tok;
-    if (line >> tok)
+    if (tok_length == 4 && memcmp(tok, "root", 4) == 0)
     {
-      if (tok[0] != ':')
+      if (current_frame < 0)
+      {
+        cerr << "We started getting bone data outside a frame." << endl;
+        return false;
+      }
+      int p = current_frame * on.frame_size;
+      int read = 0;
+      double info;
+      while (scan.number(info))
       {
-        if (tok == "root")
+        if (p + read >= (signed)positions.size())
         {
-          if (current_frame < 0)
-          {
-            cerr << "We started getting bone data outside a frame." << endl;
-            return false;
-          }
-          int p = current_frame * on.frame_size;
-          int read = 0;
-          double info;
-          while (line >> info)
-          {
-            if (p + read > (signed)positions.size())
-            {
-              cerr << "Overflow while reading." << endl;
-              return false;
-            }
-            positions[p+read] = info;
-            if (on.order[read] != tolower(on.order[read]))
-            {
-              positions[p+read] *= on.length;
-            }
-            else if (!on.ang_is_deg)
-            {
-              positions[p+read] *= 180.0 / M_PI;
-            }
-            ++read;
-          }
-          if ((unsigned)read != 6)
-          {
-            cerr << "We read " << read << " things but were expecting " << 6 << " things for root." << endl;
-            return false;
-          }
-          dof_read += read;
+          cerr << "Overflow while reading." << endl;
+          return false;
         }
-        else if (bone_map.count(tok))
+        positions[p+read] = info;
+        if (read >= (signed)on.order.size())
         {
-          if (current_frame < 0)
-          {
-            cerr << "We started getting bone data outside a frame." << endl;
-            return false;
-          }
-          int b = bone_map[tok];
-          int p = current_frame * on.frame_size + on.bones[b].frame_offset;
-          int read = 0;
-          double info;
-          while (line >> info)
-          {
-            if (p + read > (signed)positions.size())
-            {
-              cerr << "Overflow while reading." << endl;
-              return false;
-            }
-            positions[p+read] = info;
-            ++read;
-          }
-          if ((unsigned)read != on.bones[b].dof.size())
-          {
-            cerr << "We read " << read << " things but were expecting " << on.bones[b].dof.size() << " things for bone " << on.bones[b].name << "." << endl;
-            return false;
-          }
-          dof_read += read;
+          //too many; complained about below.
         }
-        else
+        else if (on.order[read] != tolower(on.order[read]))
         {
-          int num;
-          istringstream nums(tok);
-          if (nums >> num)
-          {
-            current_frame += 1;
-            if (current_frame != 0 && dof_read != on.frame_size)
-            {
-              cerr << "We read only " << dof_read << " of the total " << on.frame_size << " things we wanted." << endl;
-              return false;
-            }
-            dof_read = 0;
-            for (int i = 0; i < on.frame_size; ++i)
-            {
-              positions.push_back(0.0);
-            }
-          }
-          else
-          {
-            cerr << "We got '" << tok << "' which doesn't appear to be a frame number or bone name." << endl;
-            return false;
-          }
+          positions[p+read] *= on.length;
+        }
+        else if (!on.ang_is_deg)
+        {
+          positions[p+read] *= 180.0 / M_PI;
+        }
+        ++read;
+      }
+      if ((unsigned)read != 6)
+      {
+        cerr << "We read " << read << " things but were expecting " << 6 << " things for root." << endl;
+        return false;
+      }
+      dof_read += read;
+      continue;
+    }
+
+    int b = -1;
+    if (slot < frame_order.size())
+    {
+      string const &name = on.bones[frame_order[slot]].name;
+      if (name.size() == tok_length && memcmp(name.data(), tok, tok_length) == 0)
+      {
+        b = frame_order[slot];
+      }
+    }
+    if (b < 0)
+    {
+      map< string, int >::const_iterator found = bone_map.find(string(tok, tok_length));
+      if (found != bone_map.end())
+      {
+        b = found->second;
+        if (slot < frame_order.size()) frame_order[slot] = b;
+        else frame_order.push_back(b);
+      }
+    }
+
+    if (b >= 0)
+    {
+      if (current_frame < 0)
+      {
+        cerr << "We started getting bone data outside a frame." << endl;
+        return false;
+      }
+      ++slot;
+      int p = current_frame * on.frame_size + on.bones[b].frame_offset;
+      int read = 0;
+      double info;
+      while (scan.number(info))
+      {
+        if (p + read >= (signed)positions.size())
+        {
+          cerr << "Overflow while reading." << endl;
+          return false;
         }
+        positions[p+read] = info;
+        ++read;
+      }
+      if ((unsigned)read != on.bones[b].dof.size())
+      {
+        cerr << "We read " << read << " things but were expecting " << on.bones[b].dof.size() << " things for bone " << on.bones[b].name << "." << endl;
+        return false;
       }
+      dof_read += read;
+    }
+    else if (AmcScanner::is_integer(tok, tok_length))
+    {
+      current_frame += 1;
+      if (current_frame != 0 && dof_read != on.frame_size)
+      {
+        cerr << "We read only " << dof_read << " of the total " << on.frame_size << " things we wanted." << endl;
+        return false;
+      }
+      dof_read = 0;
+      slot = 0;
+      positions.resize(positions.size() + on.frame_size, 0.0);
+    }
+    else
+    {
+      cerr << "We got '" << string(tok, tok_length) << "' which doesn't appear to be a frame number or bone name." << endl;
+      return false;
     }
   }
   return true;
@@ -13,10 +13,16 @@ bool ReadSkeleton(string filename, Library::Skeleton &into);
 
 bool ReadSkeletonV(string filename, Library::Skeleton &into);
 
-// read 'amc' file format (automatically will call below on '.bmc' and '.v', though):
+// read 'amc' file format (automatically will call below on '.bmc' and '.v', though;
+// for x.amc or x.AMC, reads x.bmc instead if there is a good one):
 bool ReadAnimation(string filename, Library::Skeleton const &on, vector< double > &positions );
-// read the 'bmc' binary format (somewhat faster, probably):
+// read 'amc' text only, never a '.bmc' beside it:
+bool ReadAnimationAmc(string filename, Library::Skeleton const &on, vector< double > &positions );
+// read the 'bmc' binary format (somewhat faster, probably); version 2
+// files are mapped and their frames copied out in one go:
 bool ReadAnimationBin(string filename, Library::Skeleton const &on, vector< double > &positions );
+// write 'positions' (as ReadAnimation filled them) as a version 2 'bmc':
+bool WriteAnimationBin(string filename, Library::Skeleton const &on, vector< double > const &positions );
 // read the '.v' file format:
 bool ReadAnimationV(string filename, Library::Skeleton const &on, vector< double > &positions );
 
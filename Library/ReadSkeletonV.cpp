@@ -355,6 +355,7 @@ bool ReadSkeletonV(string filename, Library::Skeleton &skel)
   skel.rot_is_glob = true; // Not yet not supported (should be part of motion, not skel)
   skel.z_is_up = true; // TODO
   skel.frame_size = orig_bone_size * 6 + 6;
+  skel.compile_dofs();
 
   // clean up the hierarchy
   cout << "Hierarchy: " << endl;
@@ -588,6 +589,7 @@ void get_euler_skeleton(Library::Skeleton &transformer, const Library::Skeleton
   } // end foreach bone
 
   transformer.frame_size = 3 * transformer.bones.size() + 6;
+  transformer.compile_dofs();
 }
 
 void to_euler_angles(Character::Pose &pose, Character::Angles &angles, Library::Skeleton &transformer)
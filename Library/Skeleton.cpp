@@ -1,9 +1,14 @@
 #include "Skeleton.hpp"
+#include "Library.hpp"
 #include <assert.h>
 
 #include <iostream>
 #include <algorithm>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::cout;
 using std::endl;
 
@@ -133,9 +138,21 @@ bool Skeleton::check_parse()
     bones[b].global_to_local = ordered_rotation(bones[b].offset_order, bones[b].axis_offset);
   }
 
+  compile_dofs();
+
   return true;
 }
 
+void Skeleton::compile_dofs()
+{
+  root_decoder.compile(order);
+  root_offset = ordered_rotation(offset_order, axis_offset);
+  for (unsigned int b = 0; b < bones.size(); ++b)
+  {
+    bones[b].decoder.compile(bones[b].dof);
+  }
+}
+
 namespace
 {
 Quatd ordered_rotation(string const &order, Vector3d const &rot)
@@ -296,6 +313,52 @@ double get_rotation(Vector3d axis, Vector3d probe, Quatd const &rot)
   return atan2(rotated * perp, rotated * probe);
 }
 
+//set the angles of up to three rotations about axes vec[] (with perpendiculars
+//perp[]), at info[ind[]], to match rot.
+void put_rotations(unsigned int count, unsigned int const *ind, Vector3d const *vec, Vector3d const *perp, Quatd const &rot, double *info)
+{
+  if (count == 0)
+  {
+    return; //not much to do.
+  }
+  else if (count == 1)
+  {
+    //should be 1-d rotation, so map it down, sucker!
+    info[ind[0]] = 180.0 / M_PI * get_rotation(vec[0], perp[0], rot);
+  }
+  else if (count == 2)
+  {
+    //a 2-d rotation, I reckon.
+    double ang1 = get_rotation(vec[1], vec[0], rot);
+    info[ind[1]] = ang1 * 180.0 / M_PI;
+    info[ind[0]] = 180.0 / M_PI * get_rotation(vec[0], perp[0], multiply(conjugate(rotation(ang1, vec[1])), rot));
+  }
+  else if (count == 3)
+  {
+    //a 3-d rotation == "problem case"
+    // rot is a quaternion
+    // vec[0], vec[1], vec[2] are axes, orthonormal
+    // create Euler angles in info around these axes
+    Vector3d new0 = rotate(vec[0], rot);
+    Vector3d new1 = rotate(vec[1], rot);
+    Vector3d new2 = rotate(vec[2], rot);
+    double ang0 = atan2(new1 * vec[2], new2 * vec[2]);
+    double ang1 = -atan2(new0 * vec[2], sqrt(pow(new0 * vec[0],2) + pow(new0 * vec[1],2)));
+    double ang2 = atan2(new0 * vec[1], new0 * vec[0]);
+    info[ind[0]] = ang0 * 180.0 / M_PI;
+    info[ind[1]] = ang1 * 180.0 / M_PI;
+    info[ind[2]] = ang2 * 180.0 / M_PI;
+
+    //info[ind[0]] = 180.0 / M_PI * atan2(2*(q[0]*q[1]+q[2]*q[3]), 1 - 2*(q[1]*q[1] + q[2]*q[2]));
+    //info[ind[1]] = 180.0 / M_PI * asin(2*(q[0]*q[2] - q[3]*q[1]));
+    //info[ind[2]] = 180.0 / M_PI * atan2(2*(q[0]*q[3] + q[1]*q[2]), 1 - 2*(q[2]*q[2] + q[3]*q[3]));
+  }
+  else
+  {
+    assert(0);
+  }
+}
+
 }
 
 void put_dof_rot(string const &dof, Quatd const &rot, double *info, int start_pos)
@@ -362,48 +425,396 @@ void put_dof_rot(string const &dof, Quatd const &rot, double *info, int start_po
       assert(0);
     }
   }
-  if (count == 0)
+  put_rotations(count, ind, vec, perp, rot, info + start_pos);
+}
+
+namespace
+{
+
+//rotation by d degrees about axis AXIS (0, 1, 2 -> x, y, z), just as
+//get_dof_rot makes it:
+template< unsigned int AXIS >
+inline Quatd dof_rotation(double d)
+{
+  return rotation(d * M_PI / 180.0, make_vector(AXIS == 0 ? 1.0 : 0.0, AXIS == 1 ? 1.0 : 0.0, AXIS == 2 ? 1.0 : 0.0));
+}
+
+//decoders for each pattern of up to three rotations; same operations, in
+//the same order, as get_dof_rot on the string they were compiled from.
+Quatd decode_rot0(DofDecoder const &, double const *)
+{
+  Quatd ret;
+  ret.clear();
+  return normalize(ret);
+}
+
+template< unsigned int A >
+Quatd decode_rot1(DofDecoder const &decoder, double const *info)
+{
+  Quatd ret;
+  ret.clear();
+  ret = multiply(dof_rotation< A >(info[decoder.rot_at[0]]), ret);
+  return normalize(ret);
+}
+
+template< unsigned int A, unsigned int B >
+Quatd decode_rot2(DofDecoder const &decoder, double const *info)
+{
+  Quatd ret;
+  ret.clear();
+  ret = multiply(dof_rotation< A >(info[decoder.rot_at[0]]), ret);
+  ret = multiply(dof_rotation< B >(info[decoder.rot_at[1]]), ret);
+  return normalize(ret);
+}
+
+template< unsigned int A, unsigned int B, unsigned int C >
+Quatd decode_rot3(DofDecoder const &decoder, double const *info)
+{
+  Quatd ret;
+  ret.clear();
+  ret = multiply(dof_rotation< A >(info[decoder.rot_at[0]]), ret);
+  ret = multiply(dof_rotation< B >(info[decoder.rot_at[1]]), ret);
+  ret = multiply(dof_rotation< C >(info[decoder.rot_at[2]]), ret);
+  return normalize(ret);
+}
+
+Quatd decode_rot_generic(DofDecoder const &decoder, double const *info)
+{
+  return get_dof_rot(decoder.dof, info, 0);
+}
+
+template< bool X, bool Y, bool Z >
+Vector3d decode_trans(DofDecoder const &decoder, double const *info)
+{
+  Vector3d trans;
+  trans.x = trans.y = trans.z = 0;
+  if (X) trans.x = info[decoder.trans_at[0]];
+  if (Y) trans.y = info[decoder.trans_at[1]];
+  if (Z) trans.z = info[decoder.trans_at[2]];
+  return trans;
+}
+
+Vector3d decode_trans_generic(DofDecoder const &decoder, double const *info)
+{
+  return get_dof_trans(decoder.dof, info, 0);
+}
+
+typedef Quatd (*RotDecoder)(DofDecoder const &, double const *);
+typedef Vector3d (*TransDecoder)(DofDecoder const &, double const *);
+
+RotDecoder const rot1_decoders[3] = {
+  decode_rot1< 0 >, decode_rot1< 1 >, decode_rot1< 2 >
+};
+
+RotDecoder const rot2_decoders[3][3] = {
+  {decode_rot2< 0, 0 >, decode_rot2< 0, 1 >, decode_rot2< 0, 2 >},
+  {decode_rot2< 1, 0 >, decode_rot2< 1, 1 >, decode_rot2< 1, 2 >},
+  {decode_rot2< 2, 0 >, decode_rot2< 2, 1 >, decode_rot2< 2, 2 >}
+};
+
+RotDecoder const rot3_decoders[3][3][3] = {
+  {{decode_rot3< 0, 0, 0 >, decode_rot3< 0, 0, 1 >, decode_rot3< 0, 0, 2 >},
+   {decode_rot3< 0, 1, 0 >, decode_rot3< 0, 1, 1 >, decode_rot3< 0, 1, 2 >},
+   {decode_rot3< 0, 2, 0 >, decode_rot3< 0, 2, 1 >, decode_rot3< 0, 2, 2 >}},
+  {{decode_rot3< 1, 0, 0 >, decode_rot3< 1, 0, 1 >, decode_rot3< 1, 0, 2 >},
+   {decode_rot3< 1, 1, 0 >, decode_rot3< 1, 1, 1 >, decode_rot3< 1, 1, 2 >},
+   {decode_rot3< 1, 2, 0 >, decode_rot3< 1, 2, 1 >, decode_rot3< 1, 2, 2 >}},
+  {{decode_rot3< 2, 0, 0 >, decode_rot3< 2, 0, 1 >, decode_rot3< 2, 0, 2 >},
+   {decode_rot3< 2, 1, 0 >, decode_rot3< 2, 1, 1 >, decode_rot3< 2, 1, 2 >},
+   {decode_rot3< 2, 2, 0 >, decode_rot3< 2, 2, 1 >, decode_rot3< 2, 2, 2 >}}
+};
+
+//indexed by which of X, Y, Z are present (1, 2, 4):
+TransDecoder const trans_decoders[8] = {
+  decode_trans< false, false, false >, decode_trans< true, false, false >,
+  decode_trans< false, true, false >, decode_trans< true, true, false >,
+  decode_trans< false, false, true >, decode_trans< true, false, true >,
+  decode_trans< false, true, true >, decode_trans< true, true, true >
+};
+
+//the axes and perpendiculars put_dof_rot uses for 'x', 'y', 'z':
+Vector3d const dof_axes[3] = {
+  make_vector(1.0, 0.0, 0.0), make_vector(0.0, 1.0, 0.0), make_vector(0.0, 0.0, 1.0)
+};
+Vector3d const dof_perps[3] = {
+  make_vector(0.0, 1.0, 0.0), make_vector(0.0, 0.0, 1.0), make_vector(1.0, 0.0, 0.0)
+};
+
+}
+
+DofDecoder::DofDecoder() : generic(true), rot_count(0), rot_decoder(NULL), trans_decoder(NULL)
+{
+  trans_at[0] = trans_at[1] = trans_at[2] = -1;
+}
+
+void DofDecoder::compile(string const &_dof)
+{
+  dof = _dof;
+  generic = false;
+  rot_count = 0;
+  trans_at[0] = trans_at[1] = trans_at[2] = -1;
+  unsigned int at = 0;
+  for (unsigned int i = 0; i != dof.size(); ++i, ++at)
   {
-    return; //not much to do.
+    switch (dof[i])
+    {
+    case 'x':
+    case 'y':
+    case 'z':
+      if (rot_count < 3)
+      {
+        rot_axis[rot_count] = dof[i] - 'x';
+        rot_at[rot_count] = at;
+      }
+      else
+      {
+        generic = true;
+      }
+      ++rot_count;
+      break;
+    case 'X':
+    case 'Y':
+    case 'Z':
+      if (trans_at[dof[i] - 'X'] >= 0) generic = true;
+      trans_at[dof[i] - 'X'] = at;
+      break;
+    case 'a':
+      at += 2;
+      generic = true;
+      break;
+    default: //'l' (which just complains) and anything unexpected.
+      generic = true;
+    }
   }
-  else if (count == 1)
+
+  if (generic)
   {
-    //should be 1-d rotation, so map it down, sucker!
-    info[start_pos + ind[0]] = 180.0 / M_PI * get_rotation(vec[0], perp[0], rot);
+    rot_decoder = decode_rot_generic;
+    trans_decoder = decode_trans_generic;
+    return;
   }
-  else if (count == 2)
+  if (rot_count == 0)
   {
-    //a 2-d rotation, I reckon.
-    double ang1 = get_rotation(vec[1], vec[0], rot);
-    info[start_pos + ind[1]] = ang1 * 180.0 / M_PI;
-    info[start_pos + ind[0]] = 180.0 / M_PI * get_rotation(vec[0], perp[0], multiply(conjugate(rotation(ang1, vec[1])), rot));
+    rot_decoder = decode_rot0;
   }
-  else if (count == 3)
+  else if (rot_count == 1)
   {
-    //a 3-d rotation == "problem case"
-    // rot is a quaternion
-    // vec[0], vec[1], vec[2] are axes, orthonormal
-    // create Euler angles in info around these axes
-    Vector3d new0 = rotate(vec[0], rot);
-    Vector3d new1 = rotate(vec[1], rot);
-    Vector3d new2 = rotate(vec[2], rot);
-    double ang0 = atan2(new1 * vec[2], new2 * vec[2]);
-    double ang1 = -atan2(new0 * vec[2], sqrt(pow(new0 * vec[0],2) + pow(new0 * vec[1],2)));
-    double ang2 = atan2(new0 * vec[1], new0 * vec[0]);
-    info[start_pos + ind[0]] = ang0 * 180.0 / M_PI;
-    info[start_pos + ind[1]] = ang1 * 180.0 / M_PI;
-    info[start_pos + ind[2]] = ang2 * 180.0 / M_PI;
-
-    //info[start_pos + ind[0]] = 180.0 / M_PI * atan2(2*(q[0]*q[1]+q[2]*q[3]), 1 - 2*(q[1]*q[1] + q[2]*q[2]));
-    //info[start_pos + ind[1]] = 180.0 / M_PI * asin(2*(q[0]*q[2] - q[3]*q[1]));
-    //info[start_pos + ind[2]] = 180.0 / M_PI * atan2(2*(q[0]*q[3] + q[1]*q[2]), 1 - 2*(q[2]*q[2] + q[3]*q[3]));
+    rot_decoder = rot1_decoders[rot_axis[0]];
+  }
+  else if (rot_count == 2)
+  {
+    rot_decoder = rot2_decoders[rot_axis[0]][rot_axis[1]];
   }
   else
   {
-    assert(0);
+    rot_decoder = rot3_decoders[rot_axis[0]][rot_axis[1]][rot_axis[2]];
+  }
+  unsigned int present = 0;
+  for (unsigned int c = 0; c < 3; ++c)
+  {
+    if (trans_at[c] >= 0) present |= (1 << c);
+  }
+  trans_decoder = trans_decoders[present];
+}
+
+void DofDecoder::put_rot(Quatd const &rot, double *info) const
+{
+  if (generic)
+  {
+    put_dof_rot(dof, rot, info, 0);
+    return;
+  }
+  Vector3d vec[3];
+  Vector3d perp[3];
+  for (unsigned int r = 0; r < rot_count; ++r)
+  {
+    vec[r] = dof_axes[rot_axis[r]];
+    perp[r] = dof_perps[rot_axis[r]];
+  }
+  put_rotations(rot_count, rot_at, vec, perp, rot, info);
+}
+
+void DofDecoder::put_trans(Vector3d const &trans, double *info) const
+{
+  if (generic)
+  {
+    put_dof_trans(dof, trans, info, 0);
+    return;
+  }
+  if (trans_at[0] >= 0) info[trans_at[0]] = trans.x;
+  if (trans_at[1] >= 0) info[trans_at[1]] = trans.y;
+  if (trans_at[2] >= 0) info[trans_at[2]] = trans.z;
+}
+
+namespace
+{
+
+//For build_poses: the sine and cosine of half of each angle (in degrees,
+//as rotation() gets them from dof_rotation), reduced by multiples of pi/2
+//and then evaluated with fdlibm's polynomials, so they agree with the C
+//library's to within a unit in the last place. The SSE2 and plain
+//versions do the same operations in the same order, so they agree with
+//each other exactly.
+const double RoundingBias = 6755399441055744.0; //1.5 * 2^52; adding it rounds to an integer
+const double TwoOverPi = 6.36619772367581382433e-01;
+const double PiOver2_1 = 1.57079632673412561417e+00; //pi/2, 33 bits at a time
+const double PiOver2_2 = 6.07710050630396597660e-11;
+const double PiOver2_3 = 2.02226624871116645580e-21;
+const double S1 = -1.66666666666666324348e-01;
+const double S2 = 8.33333333332248946124e-03;
+const double S3 = -1.98412698298579493134e-04;
+const double S4 = 2.75573137070700676789e-06;
+const double S5 = -2.50507602534068634195e-08;
+const double S6 = 1.58969099521155010221e-10;
+const double C1 = 4.16666666666666019037e-02;
+const double C2 = -1.38888888888741095749e-03;
+const double C3 = 2.48015872894767294178e-05;
+const double C4 = -2.75573143513906633035e-07;
+const double C5 = 2.08757232129817482790e-09;
+const double C6 = -1.13596475577881948265e-11;
+
+void half_angle_sincos(double const *degrees, unsigned int count, double *sines, double *cosines)
+{
+  unsigned int i = 0;
+#ifdef __SSE2__
+  __m128d const pi = _mm_set1_pd(M_PI);
+  __m128d const one_eighty = _mm_set1_pd(180.0);
+  __m128d const two = _mm_set1_pd(2.0);
+  __m128d const half = _mm_set1_pd(0.5);
+  __m128d const one = _mm_set1_pd(1.0);
+  __m128d const bias = _mm_set1_pd(RoundingBias);
+  __m128d const sign = _mm_set1_pd(-0.0);
+  __m128i const bit0 = _mm_set1_epi32(1);
+  __m128i const bit1 = _mm_set1_epi32(2);
+  for (; i + 2 <= count; i += 2)
+  {
+    __m128d h = _mm_div_pd(_mm_div_pd(_mm_mul_pd(_mm_loadu_pd(degrees + i), pi), one_eighty), two);
+    __m128d k = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(h, _mm_set1_pd(TwoOverPi)), bias), bias);
+    __m128d x = _mm_sub_pd(h, _mm_mul_pd(k, _mm_set1_pd(PiOver2_1)));
+    x = _mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(PiOver2_2)));
+    x = _mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(PiOver2_3)));
+
+    __m128d z = _mm_mul_pd(x, x);
+    __m128d w = _mm_mul_pd(z, z);
+
+    //sin(x) = x + v*(S1 + z*r)
+    __m128d r = _mm_add_pd(_mm_set1_pd(S2), _mm_mul_pd(z, _mm_add_pd(_mm_set1_pd(S3), _mm_mul_pd(z, _mm_set1_pd(S4)))));
+    r = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(z, w), _mm_add_pd(_mm_set1_pd(S5), _mm_mul_pd(z, _mm_set1_pd(S6)))));
+    __m128d v = _mm_mul_pd(z, x);
+    __m128d sin_x = _mm_add_pd(x, _mm_mul_pd(v, _mm_add_pd(_mm_set1_pd(S1), _mm_mul_pd(z, r))));
+
+    //cos(x) = w + (((1 - w) - hz) + z*r), with w = 1 - hz
+    r = _mm_mul_pd(z, _mm_add_pd(_mm_set1_pd(C1), _mm_mul_pd(z, _mm_add_pd(_mm_set1_pd(C2), _mm_mul_pd(z, _mm_set1_pd(C3))))));
+    r = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(w, w), _mm_add_pd(_mm_set1_pd(C4), _mm_mul_pd(z, _mm_add_pd(_mm_set1_pd(C5), _mm_mul_pd(z, _mm_set1_pd(C6)))))));
+    __m128d hz = _mm_mul_pd(half, z);
+    w = _mm_sub_pd(one, hz);
+    __m128d cos_x = _mm_add_pd(w, _mm_add_pd(_mm_sub_pd(_mm_sub_pd(one, w), hz), _mm_mul_pd(z, r)));
+
+    //which quadrant: odd ones swap sine and cosine, then the signs
+    __m128i n = _mm_shuffle_epi32(_mm_cvttpd_epi32(k), _MM_SHUFFLE(1, 1, 0, 0));
+    __m128d swap = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(n, bit0), bit0));
+    __m128d negate_sin = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(n, bit1), bit1));
+    __m128i n_plus_one = _mm_add_epi32(n, bit0);
+    __m128d negate_cos = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(n_plus_one, bit1), bit1));
+    __m128d s = _mm_or_pd(_mm_and_pd(swap, cos_x), _mm_andnot_pd(swap, sin_x));
+    __m128d c = _mm_or_pd(_mm_and_pd(swap, sin_x), _mm_andnot_pd(swap, cos_x));
+    _mm_storeu_pd(sines + i, _mm_xor_pd(s, _mm_and_pd(negate_sin, sign)));
+    _mm_storeu_pd(cosines + i, _mm_xor_pd(c, _mm_and_pd(negate_cos, sign)));
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    double h = degrees[i] * M_PI / 180.0 / 2.0;
+    double k = (h * TwoOverPi + RoundingBias) - RoundingBias;
+    double x = ((h - k * PiOver2_1) - k * PiOver2_2) - k * PiOver2_3;
+
+    double z = x * x;
+    double w = z * z;
+    double r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+    double v = z * x;
+    double sin_x = x + v * (S1 + z * r);
+
+    r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+    double hz = 0.5 * z;
+    w = 1.0 - hz;
+    double cos_x = w + (((1.0 - w) - hz) + z * r);
+
+    int n = (int)k;
+    sines[i] = (n & 1) ? cos_x : sin_x;
+    cosines[i] = (n & 1) ? sin_x : cos_x;
+    if (n & 2) sines[i] = -sines[i];
+    if ((n + 1) & 2) cosines[i] = -cosines[i];
+  }
+}
+
+//what decoder.get_rot gives for each of 'count' frames, frame_size doubles
+//apart, built up the same way the decode_rot functions do. 'angles' is
+//somewhere to work.
+void decode_rotations(DofDecoder const &decoder, double const *frame_data, unsigned int frame_size,
+                      unsigned int count, Quatd *into, vector< double > &angles)
+{
+  assert(!decoder.generic && decoder.rot_count <= 3);
+  angles.resize(3 * decoder.rot_count * count);
+  double *sines = &(angles[0]) + decoder.rot_count * count;
+  double *cosines = sines + decoder.rot_count * count;
+  for (unsigned int r = 0; r < decoder.rot_count; ++r)
+  {
+    for (unsigned int f = 0; f < count; ++f)
+    {
+      angles[r * count + f] = frame_data[f * frame_size + decoder.rot_at[r]];
+    }
+  }
+  if (decoder.rot_count)
+  {
+    half_angle_sincos(&(angles[0]), decoder.rot_count * count, sines, cosines);
+  }
+  for (unsigned int f = 0; f < count; ++f)
+  {
+    Quatd ret;
+    ret.clear();
+    for (unsigned int r = 0; r < decoder.rot_count; ++r)
+    {
+      //as rotation() makes it:
+      Vector3d const &axis = dof_axes[decoder.rot_axis[r]];
+      double s = sines[r * count + f];
+      Quatd rot;
+      rot.w = cosines[r * count + f];
+      rot.x = axis.x * s;
+      rot.y = axis.y * s;
+      rot.z = axis.z * s;
+      ret = multiply(rot, ret);
+    }
+    into[f] = normalize(ret);
   }
 }
 
+#ifndef NDEBUG
+//(for build_poses' check) whether slot 0 of 'block' is the pose build_pose
+//makes of frame_data, to within float rounding.
+bool matches_build_pose(Skeleton const &skeleton, double const *frame_data, PoseBlock const &block)
+{
+  Character::Pose expected, got;
+  skeleton.build_pose(frame_data, expected);
+  block.get_pose(0, got);
+  float const Tolerance = 1e-6f;
+  for (unsigned int c = 0; c < 3; ++c)
+  {
+    if (fabs(expected.root_position.c[c] - got.root_position.c[c]) > Tolerance) return false;
+  }
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    if (fabs(expected.root_orientation.c[c] - got.root_orientation.c[c]) > Tolerance) return false;
+    for (unsigned int b = 0; b < expected.bone_orientations.size(); ++b)
+    {
+      if (fabs(expected.bone_orientations[b].c[c] - got.bone_orientations[b].c[c]) > Tolerance) return false;
+    }
+  }
+  return true;
+}
+#endif
+
+}
+
 //basically, just pull the 'ol root positions from each frame and
 //extract the x,z, and yaw delta.
 /*void Skeleton::build_delta(int frame_from, int frame_to, vector< double > const &positions, Character::StateDelta &delta) const {
@@ -462,16 +873,16 @@ void Skeleton::build_pose(double const *frame_data, Character::Pose &pose) const
   pose.skeleton = this;
 
 
-  pose.root_position = position + get_dof_trans(order, frame_data, 0);
+  pose.root_position = position + root_decoder.get_trans(frame_data);
 
-  pose.root_orientation = multiply(ordered_rotation(offset_order, axis_offset), get_dof_rot(order, frame_data, 0));
+  pose.root_orientation = multiply(root_offset, root_decoder.get_rot(frame_data));
 
   for (unsigned int b = 0; b < bones.size(); ++b)
   {
     Quatd rot;
     rot.clear();
     rot = multiply(conjugate(bones[b].global_to_local), rot);
-    Quatd mul = get_dof_rot(bones[b].dof, frame_data, bones[b].frame_offset);
+    Quatd mul = bones[b].decoder.get_rot(frame_data + bones[b].frame_offset);
     rot = multiply(mul, rot);
     rot = multiply(bones[b].global_to_local, rot);
     rot = normalize(rot);
@@ -485,7 +896,7 @@ void Skeleton::build_pose(double const *frame_data, Character::Pose &pose) const
       if (bones[b].parent==-1)
       {
         Quatf f;
-        f = get_dof_rot(order, frame_data, 0);
+        f = root_decoder.get_rot(frame_data);
         pose.bone_orientations[b] = multiply(conjugate(f), pose.bone_orientations[b]);
       }
       else
@@ -506,6 +917,88 @@ void Skeleton::build_pose(double const *frame_data, Character::Pose &pose) const
   }
 }
 
+void Skeleton::build_poses(double const *frame_data, unsigned int count, PoseBlock &into) const
+{
+  assert(into.frames >= count);
+  assert(into.bones == bones.size());
+  into.skeleton = this;
+  if (count == 0) return;
+
+  bool compiled = !root_decoder.generic;
+  for (unsigned int b = 0; b < bones.size(); ++b)
+  {
+    if (bones[b].decoder.generic) compiled = false;
+  }
+  if (!compiled || rot_is_glob)
+  {
+    //strings with 'a' or 'l' in them, and global rotations, one at a time:
+    Character::Pose pose;
+    for (unsigned int f = 0; f < count; ++f)
+    {
+      build_pose(frame_data + f * frame_size, pose);
+      into.set_pose(f, pose);
+    }
+    return;
+  }
+
+  vector< Quatd > rotations(count);
+  vector< double > angles;
+
+  //root, just as build_pose does it:
+  decode_rotations(root_decoder, frame_data, frame_size, count, &(rotations[0]), angles);
+  Quatf z_up;
+  z_up = rotation( -(float)M_PI * 0.5f, make_vector(1.0f, 0.0f, 0.0f) );
+  for (unsigned int f = 0; f < count; ++f)
+  {
+    Vector3f root_position;
+    root_position = position + root_decoder.get_trans(frame_data + f * frame_size);
+    Quatf root_orientation;
+    root_orientation = multiply(root_offset, rotations[f]);
+    if (z_is_up)
+    {
+      root_position = rotate(root_position, z_up);
+      root_orientation = multiply(z_up, root_orientation);
+    }
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+      into.root_position(c)[f] = root_position.c[c];
+    }
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      into.orientation(0, c)[f] = root_orientation.c[c];
+    }
+  }
+
+  for (unsigned int b = 0; b < bones.size(); ++b)
+  {
+    Bone const &bone = bones[b];
+    decode_rotations(bone.decoder, frame_data + bone.frame_offset, frame_size, count, &(rotations[0]), angles);
+    Quatd start;
+    start.clear();
+    start = multiply(conjugate(bone.global_to_local), start);
+    float *planes[4];
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      planes[c] = into.orientation(b + 1, c);
+    }
+    for (unsigned int f = 0; f < count; ++f)
+    {
+      Quatd rot;
+      rot = multiply(rotations[f], start);
+      rot = multiply(bone.global_to_local, rot);
+      rot = normalize(rot);
+      Quatf orientation;
+      orientation = rot;
+      for (unsigned int c = 0; c < 4; ++c)
+      {
+        planes[c][f] = orientation.c[c];
+      }
+    }
+  }
+
+  assert(matches_build_pose(*this, frame_data, into));
+}
+
 void Skeleton::get_angles(Character::Pose const &from, double *to) const
 {
   if (rot_is_glob)
@@ -525,13 +1018,13 @@ void Skeleton::get_angles(Character::Pose const &from, double *to) const
   //make sure we have the right amount of input bones.
   assert(bones.size() == from.bone_orientations.size());
 
-  put_dof_trans(order, make_vector< double >(from.root_position) - position, to, 0);
+  root_decoder.put_trans(make_vector< double >(from.root_position) - position, to);
   //from: pose.root_position = position + get_dof_trans(order, frame_data, 0);
 
   Quatd root_orientation;
   root_orientation = from.root_orientation;
-  root_orientation = multiply(conjugate(ordered_rotation(offset_order, axis_offset)), root_orientation);
-  put_dof_rot(order, root_orientation, to, 0);
+  root_orientation = multiply(conjugate(root_offset), root_orientation);
+  root_decoder.put_rot(root_orientation, to);
   //from: pose.root_orientation = multiply(ordered_rotation(offset_order, axis_offset), get_dof_rot(order, frame_data, 0));
   for (unsigned int b = 0; b < bones.size(); ++b)
   {
@@ -549,9 +1042,9 @@ void Skeleton::get_angles(Character::Pose const &from, double *to) const
     rot = from.bone_orientations[b];
     rot = multiply(rot, bones[b].global_to_local);
     rot = multiply(conjugate(bones[b].global_to_local), rot);
-    put_dof_rot(bones[b].dof, rot, to, bones[b].frame_offset);
+    bones[b].decoder.put_rot(rot, to + bones[b].frame_offset);
     //DEBUG:
-    Quatd other = get_dof_rot(bones[b].dof, to, bones[b].frame_offset);
+    Quatd other = bones[b].decoder.get_rot(to + bones[b].frame_offset);
     if (::length(other.xyzw - rot.xyzw) > 0.01
         && ::length(-other.xyzw - rot.xyzw) > 0.01)
     {
@@ -19,8 +19,42 @@ using std::vector;
 using std::cerr;
 using std::endl;
 
+class PoseBlock;
+
 //collection of joint angles, offset matrices, and so on.
 
+//a dof string (see Bone::dof) worked out ahead of time: where each channel
+//sits, and a decoder made for exactly that pattern of axes. Building a pose
+//then doesn't have to switch over the string for every channel of every
+//frame. Strings with 'a' or 'l' in them are still read the slow way.
+class DofDecoder
+{
+public:
+  DofDecoder();
+  void compile(string const &dof);
+
+  //same as reading/writing 'dof' at info with get_dof_rot/put_dof_rot:
+  inline Quatd get_rot(double const *info) const
+  {
+    return rot_decoder(*this, info);
+  }
+  inline Vector3d get_trans(double const *info) const
+  {
+    return trans_decoder(*this, info);
+  }
+  void put_rot(Quatd const &rot, double *info) const;
+  void put_trans(Vector3d const &trans, double *info) const;
+
+  string dof; //what this was compiled from.
+  bool generic; //uses the string after all.
+  unsigned int rot_count;
+  unsigned int rot_axis[3]; //0, 1, 2 -> rotation about x, y, z
+  unsigned int rot_at[3]; //where each rotation's value is
+  int trans_at[3]; //where X, Y, Z values are (-1 -> not in dof)
+  Quatd (*rot_decoder)(DofDecoder const &, double const *);
+  Vector3d (*trans_decoder)(DofDecoder const &, double const *);
+};
+
 class Bone
 {
 public:
@@ -44,6 +78,8 @@ public:
 
   int frame_offset; //where in lists of per-frame data this fellow's data rests.
 
+  DofDecoder decoder; //dof, as compiled by Skeleton::compile_dofs.
+
   // filled, but not yet taken advantage of
   vector< Vector3d > euler_axes; // for v-file. Actual axes of joint rotation
 
@@ -63,6 +99,7 @@ public:
     offset_order = "xyz";
     radius = density = length = -1;
     dof = "";
+    decoder = DofDecoder();
     torque_limits.clear();
     color.r = rand() / double(RAND_MAX);
     color.g = rand() / double(RAND_MAX);
@@ -145,10 +182,20 @@ public:
 
   //large, has setup for bones. Stuff like that.
   bool check_parse();
+  //(re-)compile the root's and bones' dof strings for build_pose and
+  //get_angles; check_parse does this, but anything that changes order,
+  //offset_order, axis_offset or a dof afterward needs to call it again.
+  void compile_dofs();
 
   //void build_delta(int frame_from, int frame_to, vector< double > const &data, Character::StateDelta &into) const;
   void build_angles(int frame, vector< double > const &data, Character::Angles &into) const;
   void build_pose(double const *frame_data, Character::Pose &into) const;
+  //build_pose for 'count' frames (frame_size doubles apart) into slots
+  //0 .. count - 1 of 'into', which must already be that big. Each bone's
+  //rotations are worked out across all the frames at once, the sines and
+  //cosines a vector at a time; the poses are build_pose's to within float
+  //rounding (debug builds check the first against it).
+  void build_poses(double const *frame_data, unsigned int count, PoseBlock &into) const;
   //Note: into needs to have frame_size storage locations availible!
   void get_angles(Character::Pose const &from, double *into) const;
 
@@ -165,6 +212,9 @@ public:
 
   int frame_size; //how may dof per frame.
 
+  DofDecoder root_decoder; //order, compiled.
+  Quatd root_offset; //axis_offset rotation, in offset_order.
+
   string filename; //what file this was loaded from.
 };
 
@@ -239,10 +239,12 @@ void writeVToBvh(unsigned int motion)
   vector< int > order;
   writeHierarchyBvh(bvhFile, *(m.skeleton), m.frames(), order);
 
+  Library::PoseBlock poses;
+  m.get_poses(0, m.frames(), poses);
+  Character::Pose pose;
   for (unsigned int f = 0; f < m.frames(); f++)
   {
-    Character::Pose pose;
-    m.get_pose(f,pose);
+    poses.get_pose(f, pose);
     writeFrameBvh(bvhFile, pose, order);
   }
   bvhFile.close();
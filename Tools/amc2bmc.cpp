@@ -0,0 +1,323 @@
+//converts every .amc under some data directories into a .bmc beside it
+//(the binary format ReadAnimation prefers when it finds one; x.AMC gets
+//x.bmc too, which is the name ReadAnimation looks for), skipping
+//any .bmc that is already newer than its .amc and skeleton.
+
+#include <Library/ReadSkeleton.hpp>
+#include <Library/Parallel.hpp>
+#include <Library/FileView.hpp>
+
+#include <SDL.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#include <io.h>
+#define SEP '\\'
+#else
+#include <dirent.h>
+#include <unistd.h>
+#define SEP '/'
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::deque;
+
+namespace
+{
+
+void usage(char const *program)
+{
+  cerr << "Usage:\n  " << program << " [options] [data directory ...]\n"
+       << "Writes x.bmc beside every x.amc; data directory defaults to 'data'.\n"
+       << "Options:\n"
+       << "  -t <threads> threads to convert with (default: one per processor)\n"
+       << "  -f           convert even if the .bmc is already up to date\n"
+       << "  -q           only report failures" << endl;
+}
+
+bool ends_with(string const &name, char const *suffix)
+{
+  string::size_type length = strlen(suffix);
+  return name.size() > length && name.compare(name.size() - length, length, suffix) == 0;
+}
+
+//modification time and size; false if the file isn't there.
+bool file_info(string const &filename, time_t &mtime, double &size)
+{
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) return false;
+  mtime = info.st_mtime;
+  size = info.st_size;
+  return true;
+}
+
+class Conversion
+{
+public:
+  unsigned int skeleton;
+  string amc;
+  string bmc;
+  double bytes; //size of amc
+};
+
+//finds skeletons and amc files the same way Library::directory_recursion
+//does: one .asf per directory, with the .amc's beside it.
+void find_conversions(string const &base_path, deque< Library::Skeleton > &skeletons,
+                      vector< time_t > &skeleton_times, vector< Conversion > &into)
+{
+  string skeleton_path = "";
+  vector< string > amc_paths;
+  vector< string > dir_paths;
+#ifndef WINDOWS
+  DIR *dir = opendir(base_path.c_str());
+  if (dir == NULL)
+  {
+    cerr << "Cannot open directory '" << base_path << "'" << endl;
+    return;
+  }
+  struct dirent *ent;
+  while ((ent = readdir(dir)))
+  {
+    string name = string(ent->d_name);
+#else
+  struct _finddata_t fileinfo;
+  intptr_t handle = _findfirst((base_path + "\\*").c_str(), &fileinfo);
+  if (handle == -1)
+  {
+    cerr << "Cannot _findfirst on '" << base_path << "\\*'" << endl;
+    return;
+  }
+  while (1)
+  {
+    string name = string(fileinfo.name);
+#endif
+    if (ends_with(name, ".asf") || ends_with(name, ".ASF"))
+    {
+      skeleton_path = base_path + SEP + name;
+    }
+    else if (ends_with(name, ".amc") || ends_with(name, ".AMC"))
+    {
+      amc_paths.push_back(base_path + SEP + name);
+    }
+    else if (name[0] != '.' && !ends_with(name, ".bmc") && !ends_with(name, ".ann"))
+    {
+      struct stat info;
+      if (stat((base_path + SEP + name).c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR)
+      {
+        dir_paths.push_back(base_path + SEP + name);
+      }
+    }
+#ifndef WINDOWS
+  }
+  closedir(dir);
+#else
+    if (0 != _findnext(handle, &fileinfo)) break;
+  }
+  _findclose(handle);
+#endif
+
+  std::sort(amc_paths.begin(), amc_paths.end());
+  std::sort(dir_paths.begin(), dir_paths.end());
+
+  if (skeleton_path != "" && !amc_paths.empty())
+  {
+    skeletons.push_back(Library::Skeleton());
+    time_t skeleton_time = 0;
+    double skeleton_size = 0;
+    if (!ReadSkeleton(skeleton_path, skeletons.back())
+        || !file_info(skeleton_path, skeleton_time, skeleton_size))
+    {
+      cerr << "Error reading skeleton from " << skeleton_path << "." << endl;
+      skeletons.pop_back();
+    }
+    else
+    {
+      skeleton_times.push_back(skeleton_time);
+      for (unsigned int i = 0; i < amc_paths.size(); ++i)
+      {
+        Conversion conversion;
+        conversion.skeleton = skeletons.size() - 1;
+        conversion.amc = amc_paths[i];
+        conversion.bmc = amc_paths[i];
+        conversion.bmc[conversion.bmc.size() - 3] = 'b';
+        conversion.bmc[conversion.bmc.size() - 2] = 'm';
+        conversion.bmc[conversion.bmc.size() - 1] = 'c';
+        conversion.bytes = 0;
+        into.push_back(conversion);
+      }
+    }
+  }
+  for (unsigned int i = 0; i < dir_paths.size(); ++i)
+  {
+    find_conversions(dir_paths[i], skeletons, skeleton_times, into);
+  }
+}
+
+//one piece per conversion; the .bmc is written under a temporary name
+//and renamed into place, so a reader never sees half of one.
+class ConvertJob : public Library::ParallelJob
+{
+public:
+  ConvertJob(deque< Library::Skeleton > const &_skeletons, vector< Conversion > const &_conversions)
+  : skeletons(_skeletons), conversions(_conversions), converted(_conversions.size(), 0)
+  {
+  }
+
+  virtual void run(unsigned int piece)
+  {
+    Conversion const &conversion = conversions[piece];
+    Library::Skeleton const &skeleton = skeletons[conversion.skeleton];
+    vector< double > positions;
+    if (!ReadAnimationAmc(conversion.amc, skeleton, positions)) return;
+    //a name of its own, so two converters over the same directory can't
+    //rename or remove each other's half-written files:
+    string temp = Library::claimTempFile(conversion.bmc);
+    if (temp.empty()) return;
+    if (!WriteAnimationBin(temp, skeleton, positions))
+    {
+      remove(temp.c_str());
+      return;
+    }
+#ifdef WINDOWS
+    //(rename won't replace an existing file here)
+    remove(conversion.bmc.c_str());
+#endif
+    if (rename(temp.c_str(), conversion.bmc.c_str()) != 0)
+    {
+      remove(temp.c_str());
+      return;
+    }
+    converted[piece] = 1;
+  }
+
+  deque< Library::Skeleton > const &skeletons;
+  vector< Conversion > const &conversions;
+  vector< char > converted; //(not vector< bool >; pieces write these at once)
+};
+
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int threads = 0;
+  bool force = false;
+  bool report = true;
+  vector< string > paths;
+
+  for (int a = 1; a < argc; ++a)
+  {
+    string arg = argv[a];
+    if (arg == "-f")
+    {
+      force = true;
+    }
+    else if (arg == "-q")
+    {
+      report = false;
+    }
+    else if (arg == "-t" && a + 1 < argc)
+    {
+      threads = atoi(argv[++a]);
+    }
+    else if (arg.size() > 0 && arg[0] != '-')
+    {
+      paths.push_back(arg);
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (paths.empty())
+  {
+    paths.push_back("data");
+  }
+
+  if (SDL_Init(SDL_INIT_TIMER) != 0)
+  {
+    cerr << "Could not initialize sdl: " << SDL_GetError() << endl;
+    return 1;
+  }
+
+  deque< Library::Skeleton > skeletons;
+  vector< time_t > skeleton_times;
+  vector< Conversion > found;
+  for (unsigned int p = 0; p < paths.size(); ++p)
+  {
+    find_conversions(paths[p], skeletons, skeleton_times, found);
+  }
+
+  //skip anything whose .bmc is newer than both its .amc and skeleton (a
+  //.bmc from the same second might not be, so that gets redone):
+  vector< Conversion > conversions;
+  unsigned int up_to_date = 0;
+  for (unsigned int i = 0; i < found.size(); ++i)
+  {
+    time_t amc_time = 0, bmc_time = 0;
+    double bmc_size = 0;
+    if (!file_info(found[i].amc, amc_time, found[i].bytes))
+    {
+      cerr << "Cannot stat '" << found[i].amc << "'." << endl;
+      continue;
+    }
+    if (!force && file_info(found[i].bmc, bmc_time, bmc_size)
+        && bmc_time > amc_time && bmc_time > skeleton_times[found[i].skeleton])
+    {
+      ++up_to_date;
+      continue;
+    }
+    conversions.push_back(found[i]);
+  }
+
+  unsigned int start = SDL_GetTicks();
+  ConvertJob job(skeletons, conversions);
+  Library::parallel_for(job, conversions.size(), threads);
+  float seconds = (SDL_GetTicks() - start) / 1000.0f;
+
+  unsigned int failed = 0;
+  double bytes = 0;
+  for (unsigned int i = 0; i < conversions.size(); ++i)
+  {
+    if (job.converted[i])
+    {
+      bytes += conversions[i].bytes;
+      if (report) cout << "Wrote " << conversions[i].bmc << endl;
+    }
+    else
+    {
+      cerr << "Could not convert '" << conversions[i].amc << "'." << endl;
+      ++failed;
+    }
+  }
+
+  if (report)
+  {
+    cout << "Converted " << conversions.size() - failed << " motions ("
+         << bytes / (1024.0 * 1024.0) << " MB of amc) in " << seconds << " seconds";
+    if (seconds > 0.0f)
+    {
+      cout << ", " << bytes / (1024.0 * 1024.0) / seconds << " MB/s";
+    }
+    cout << "; " << up_to_date << " already up to date";
+    if (failed) cout << ", " << failed << " failed";
+    cout << "." << endl;
+  }
+
+  SDL_Quit();
+  return failed ? 1 : 0;
+}
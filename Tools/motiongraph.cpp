@@ -0,0 +1,126 @@
+//builds a motion graph (Library/MotionGraph.hpp) over every motion in a
+//data directory and saves it where the browser looks for it.
+
+#include <Library/Library.hpp>
+#include <Library/MotionGraph.hpp>
+
+#include <SDL.h>
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+namespace
+{
+
+void usage(char const *program)
+{
+  cerr << "Usage:\n  " << program << " [options] [data directory] [graph file]\n"
+       << "Graph file defaults to <data directory>/.cache/motion.graph.\n"
+       << "Options:\n"
+       << "  -w <frames>  blend window (default 30)\n"
+       << "  -k <edges>   most edges to keep per pair of motions (default 4)\n"
+       << "  -c <cost>    drop edges costing more than this; also lets pairs that\n"
+       << "               can't get that cheap be skipped (default: keep all)\n"
+       << "  -t <threads> threads to load motions and build with (default: one per\n"
+       << "               processor)\n"
+       << "  -q           don't report progress" << endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  Library::MotionGraph::Options options;
+  string path = "data";
+  string graph_file = "";
+  unsigned int paths = 0;
+
+  for (int a = 1; a < argc; ++a)
+  {
+    string arg = argv[a];
+    if (arg == "-q")
+    {
+      options.report = false;
+    }
+    else if (arg.size() == 2 && arg[0] == '-' && a + 1 < argc)
+    {
+      char const *value = argv[++a];
+      if (arg == "-w") options.window = atoi(value);
+      else if (arg == "-k") options.per_pair = atoi(value);
+      else if (arg == "-c") options.max_cost = atof(value);
+      else if (arg == "-t") options.threads = atoi(value);
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (arg[0] != '-' && paths == 0)
+    {
+      path = arg;
+      ++paths;
+    }
+    else if (arg[0] != '-' && paths == 1)
+    {
+      graph_file = arg;
+      ++paths;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.window == 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (SDL_Init(SDL_INIT_TIMER) != 0)
+  {
+    cerr << "Could not initialize sdl: " << SDL_GetError() << endl;
+    return 1;
+  }
+
+  Library::init(path, false, options.threads);
+  if (Library::motion_count() == 0)
+  {
+    cerr << "Could not find any motions in directory '" << path << "'." << endl;
+    SDL_Quit();
+    return 1;
+  }
+  if (graph_file == "")
+  {
+    graph_file = Library::cache_file("motion.graph");
+  }
+
+  Library::MotionGraph graph;
+  graph.build(options);
+
+  unsigned int edges = 0;
+  for (unsigned int m = 0; m < graph.motions(); ++m)
+  {
+    edges += graph.edge_count(m);
+  }
+
+  int ret = 0;
+  if (graph.save(graph_file))
+  {
+    cout << "Saved " << edges << " transitions to '" << graph_file << "'." << endl;
+  }
+  else
+  {
+    cerr << "Could not save motion graph to '" << graph_file << "'." << endl;
+    ret = 1;
+  }
+
+  SDL_Quit();
+  return ret;
+}